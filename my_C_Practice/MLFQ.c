@@ -5,54 +5,133 @@
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
-
+#include <stdatomic.h>
+
+#include "eventcount.h"
+#include "job_pool.h"
+#include "line_reader.h"
+#include "des_sim.h"
+#include "timer_wheel.h"
+#include "green.h"
+#include "job_trace.h"
+#include "workload.h"
+#include "lat_hist.h"
+
+#ifndef NUM_PROD
 #define NUM_PROD    1
+#endif
 #define NUM_CONS    4
 #define NUM_LEVELS  3
 #define CAPACITY    1024
+#define CACHE_LINE  64
+#ifndef BOOST_MS
 #define BOOST_MS    200
+#endif
+
+/* share of slices cut short by I/O: the job gives the cpu back early and
+ * sleeps IO_MS on the timer wheel before it is queued again */
+#ifndef IO_PERCENT
+#define IO_PERCENT  0
+#endif
+#define IO_MS       10
+
+/* 1 = discrete-event simulation on a virtual clock (see des_sim.h) instead
+ * of consumer threads that sleep through every slice */
+#ifndef SIMULATE
+#define SIMULATE 0
+#endif
+
+/* 1 = each job is a green thread (green.h) that does cost ms of real cpu
+ * work and is preempted at its next safe point once the quantum timer
+ * fires, instead of a slice the consumer sleeps through */
+#ifndef GREEN
+#define GREEN 0
+#endif
+#define GREEN_CHECK 256         /* work rounds between safe points */
+
+/* mean virtual ms between arrivals: ~92% load on NUM_CONS cpus */
+#ifndef SIM_MEAN_GAP
+#define SIM_MEAN_GAP 8
+#endif
 
 typedef struct Job {
     int id;
-    char *payload;
+    Line payload;
     int priority;
     int cost;
+    unsigned epoch;             /* boost_epoch when it was queued */
+    int level;                  /* to queue at once awake, or SIMULATE's */
+    struct Mlfq *home;          /* where it sleeps back to */
+    Timer wake;
+    JobTimes times;             /* LAT_STATS, by level */
+    SimJob sim;                 /* SIMULATE only */
+    Green *green;               /* GREEN only */
+    uint32_t sum;               /* GREEN's work, so it is not optimized out */
+    struct Job *next;
 } Job;
 
 typedef struct ReadySet {
-    Job   **jobs;
-    size_t cap, count;
+    Job   **jobs;               /* FIFO ring */
+    size_t cap, count, head;
+    unsigned bit;               /* this level's bit in nonempty */
     pthread_mutex_t mtx;
     pthread_cond_t  not_full;
     
 } ReadySet;
 
-
-static ReadySet queues[NUM_LEVELS];
+/* One MLFQ per consumer. The producer puts a new job on the least-loaded
+ * one, a job that used up its slice goes back on the queues of the consumer
+ * that ran it, and only a consumer with nothing of its own steals, the next
+ * job of the most loaded other MLFQ. So a job keeps running where it last
+ * ran, and the queue locks and bitmasks are normally touched by one thread.
+ * load counts the jobs an MLFQ is responsible for, the running one
+ * included, so an idle consumer reads as 0.
+ *
+ * Within an MLFQ, bit lvl of nonempty is set while queues[lvl] holds a job;
+ * it only changes under that level's lock, when count goes 0 -> 1 or
+ * 1 -> 0, so the highest ready level is one load away. Idle consumers
+ * sleep on the shared any_ready once every MLFQ is empty; a new job
+ * notifies it, which is a fence and a load unless someone sleeps.
+ *
+ * A boost moves nothing. It bumps boost_epoch, so every job queued before
+ * it runs as a level 0 job when it is popped, and marks the levels that
+ * held jobs stale, so they are looked at right after level 0. Since the
+ * levels are FIFO, a stale level's boosted jobs are all at its head, and
+ * the bit is cleared once the head is from the current epoch. A push or
+ * pop that races a boost can only misplace a job in the pick order; the
+ * level it then runs at is still decided by its epoch.
+ *
+ * Time is kept by one timer wheel: each MLFQ's boost is a periodic timer,
+ * each consumer's slice ends when its quantum timer fires, and a job
+ * sleeping on I/O is a timer that queues it again. */
+typedef struct Mlfq {
+    ReadySet queues[NUM_LEVELS];
+    _Atomic unsigned nonempty;
+    _Atomic unsigned stale;
+    _Atomic unsigned boost_epoch;
+    Timer boost;
+    _Alignas(CACHE_LINE) _Atomic int load;
+} Mlfq;
+
+static Mlfq     cores[NUM_CONS];
 static int      Quanta[NUM_LEVELS] = {5, 10, 20}; 
-static pthread_mutex_t any_mtx = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t  any_not_empty = PTHREAD_COND_INITIALIZER;
-static volatile int    running = 1;
-static int next_job_id = 0;
-static struct timespec last_boost;
+static EventCount any_ready;
+static _Atomic int running = 1;
+static _Atomic int sleeping;    /* jobs waiting on the wheel */
+static Wheel wheel;
 
 static inline int min_int(int a,int b){ return a < b ? a : b; }
 
-static long now_ms(void){
-    struct timespec t; clock_gettime(CLOCK_MONOTONIC, &t);
-    return (long)(t.tv_sec*1000LL + t.tv_nsec/1000000LL);
-}
-
-static void ms_sleep(int ms){
-    struct timespec ts={ ms/1000, (ms%1000)*1000000L };
-    nanosleep(&ts,NULL);
+static inline uint64_t ms_ticks(int ms){
+    return (uint64_t)ms * 1000 / WHEEL_TICK_US;
 }
 
 
-static void rs_init(ReadySet *rs, size_t cap){
+static void rs_init(ReadySet *rs, size_t cap, int lvl){
     rs->jobs = malloc(cap * sizeof *rs->jobs);
     if(!rs->jobs){ perror("malloc"); exit(1); }
-    rs->cap = cap; rs->count = 0;
+    rs->cap = cap; rs->count = 0; rs->head = 0;
+    rs->bit = 1u << lvl;
     pthread_mutex_init(&rs->mtx, NULL);
     pthread_cond_init(&rs->not_full, NULL);
 }
@@ -63,134 +142,623 @@ static void rs_destroy(ReadySet *rs){
     free(rs->jobs);
 }
 
+static void mlfq_init(Mlfq *m){
+    for(int lvl=0; lvl<NUM_LEVELS; ++lvl) rs_init(&m->queues[lvl], CAPACITY, lvl);
+    atomic_init(&m->nonempty, 0);
+    atomic_init(&m->stale, 0);
+    atomic_init(&m->boost_epoch, 0);
+    atomic_init(&m->load, 0);
+}
+
+static void mlfq_destroy(Mlfq *m){
+    for(int lvl=0; lvl<NUM_LEVELS; ++lvl) rs_destroy(&m->queues[lvl]);
+}
+
 
-static void rs_push(ReadySet *rs, Job *j){
+/* caller holds rs->mtx and checked for room */
+static void rs_put(Mlfq *m, ReadySet *rs, Job *j){
+    j->epoch = atomic_load(&m->boost_epoch);
+    if(rs->count == 0) atomic_fetch_or(&m->nonempty, rs->bit);
+    rs->jobs[(rs->head + rs->count++) % rs->cap] = j;
+}
+
+static void rs_push(Mlfq *m, int lvl, Job *j){
+    ReadySet *rs = &m->queues[lvl];
     pthread_mutex_lock(&rs->mtx);
     while(rs->count == rs->cap){
         pthread_cond_wait(&rs->not_full, &rs->mtx);
     }
-    rs->jobs[rs->count++] = j;
+    rs_put(m, rs, j);
     pthread_mutex_unlock(&rs->mtx);
+}
 
-    pthread_mutex_lock(&any_mtx);
-    pthread_cond_signal(&any_not_empty);
-    pthread_mutex_unlock(&any_mtx);
+/* rs_push() that returns 0 instead of waiting for room. */
+static int rs_try_push(Mlfq *m, int lvl, Job *j){
+    ReadySet *rs = &m->queues[lvl];
+    int ok = 0;
+    pthread_mutex_lock(&rs->mtx);
+    if(rs->count < rs->cap){
+        rs_put(m, rs, j);
+        ok = 1;
+    }
+    pthread_mutex_unlock(&rs->mtx);
+    return ok;
 }
 
-static Job* rs_try_pop(ReadySet *rs){
+/* Pops the oldest job; *lvl becomes 0 if it was queued before a boost. */
+static Job* rs_try_pop(Mlfq *m, int at, int *lvl){
+    ReadySet *rs = &m->queues[at];
     Job *ret = NULL;
     pthread_mutex_lock(&rs->mtx);
     if(rs->count){
-        size_t idx = rs->count - 1;
-        ret = rs->jobs[idx];
-        rs->count--;
+        unsigned epoch = atomic_load(&m->boost_epoch);
+        ret = rs->jobs[rs->head];
+        rs->head = (rs->head + 1) % rs->cap;
+        if(--rs->count == 0) atomic_fetch_and(&m->nonempty, ~rs->bit);
+        if((atomic_load(&m->stale) & rs->bit) &&
+           (rs->count == 0 || rs->jobs[rs->head]->epoch == epoch)){
+            atomic_fetch_and(&m->stale, ~rs->bit);
+        }
+        if(ret->epoch != epoch) *lvl = 0;
         pthread_cond_signal(&rs->not_full);
     }
     pthread_mutex_unlock(&rs->mtx);
     return ret;
 }
 
+/* Next job of m by level, or NULL once m is empty. */
+static Job* mlfq_try_pop(Mlfq *m, int *out_lvl){
+    unsigned mask;
+    while((mask = atomic_load(&m->nonempty))){
+        /* boosted jobs in lower levels rank right after level 0 */
+        unsigned boosted = atomic_load(&m->stale) & mask;
+        int at  = ((mask & 1u) || !boosted) ? __builtin_ctz(mask) : __builtin_ctz(boosted);
+        int lvl = at;
+        Job *j = rs_try_pop(m, at, &lvl);
+        if(j){ *out_lvl = lvl; return j; }
+        /* lost the race for it: look again */
+    }
+    return NULL;
+}
 
-static Job* mlfq_pop(int *out_lvl){
+/* Takes the next job of the most loaded MLFQ that has one queued. */
+static Job* mlfq_steal(Mlfq *me, int *out_lvl){
     for(;;){
-        for(int lvl=0; lvl<NUM_LEVELS; ++lvl){
-            Job *j = rs_try_pop(&queues[lvl]);
-            if(j){ if(out_lvl) *out_lvl = lvl; return j; }
+        Mlfq *victim = NULL;
+        int most = 0;
+        for(int i=0; i<NUM_CONS; ++i){
+            Mlfq *m = &cores[i];
+            int load = atomic_load_explicit(&m->load, memory_order_relaxed);
+            if(m != me && atomic_load(&m->nonempty) && (!victim || load > most)){
+                victim = m;
+                most = load;
+            }
+        }
+        if(!victim) return NULL;
+
+        Job *j = mlfq_try_pop(victim, out_lvl);
+        if(j){
+            atomic_fetch_sub(&victim->load, 1);
+            atomic_fetch_add(&me->load, 1);
+            return j;
         }
-     
-        pthread_mutex_lock(&any_mtx);
-        if(!running){ pthread_mutex_unlock(&any_mtx); return NULL; }
-        pthread_cond_wait(&any_not_empty, &any_mtx);
-        pthread_mutex_unlock(&any_mtx);
     }
 }
 
+static int any_queued(void){
+    for(int i=0; i<NUM_CONS; ++i){
+        if(atomic_load(&cores[i].nonempty)) return 1;
+    }
+    return 0;
+}
+
+static Job* mlfq_pop(Mlfq *me, int *out_lvl){
+    for(;;){
+        Job *j = mlfq_try_pop(me, out_lvl);
+        if(!j) j = mlfq_steal(me, out_lvl);
+        if(j) return j;
+        pool_flush();
+
+        uint32_t key = ec_prepare(&any_ready);
+        /* a waking job is queued before sleeping drops, so read sleeping
+         * first: if it was 0, any_queued() sees the job */
+        int done = !atomic_load(&running) && !atomic_load(&sleeping);
+        if(any_queued()){ ec_cancel(&any_ready, key); continue; }
+        if(done){ ec_cancel(&any_ready, key); return NULL; }
+        ec_wait(&any_ready, key, NULL);
+    }
+}
+
+/* Queues a new job on the least-loaded MLFQ, starting the scan after the
+ * last pick so ties rotate. */
+static void mlfq_place(Job *j){
+    static __thread int hint;
+    Mlfq *best = NULL;
+    int least = 0;
+    for(int k=0; k<NUM_CONS; ++k){
+        Mlfq *m = &cores[(hint + 1 + k) % NUM_CONS];
+        int load = atomic_load_explicit(&m->load, memory_order_relaxed);
+        if(!best || load < least){ best = m; least = load; }
+    }
+    hint = (int)(best - cores);
 
-static void maybe_boost(void){
-    long now = now_ms();
-    static long last = -1;
-    if(last < 0) last = now;
-    if(now - last < BOOST_MS) return;
-    last = now;
+    atomic_fetch_add(&best->load, 1);
+    rs_push(best, 0, j);
+    ec_notify(&any_ready, 1);
+}
 
+static void mlfq_stop(void){
+    atomic_store(&running, 0);
+    ec_notify(&any_ready, UINT32_MAX);
+}
 
-    for(int lvl=1; lvl<NUM_LEVELS; ++lvl){
-        for(;;){
-            Job *j = rs_try_pop(&queues[lvl]);
-            if(!j) break;
-            rs_push(&queues[0], j);
+
+/* Feedback: a job that gave the cpu back before its quantum ran out moves
+ * up a level, one that used all of it moves down. */
+static int next_level(int lvl, int slice, int quantum){
+    if(slice < quantum) return (lvl > 0) ? lvl - 1 : 0;
+    return (lvl < NUM_LEVELS-1) ? lvl + 1 : lvl;
+}
+
+/* Boost timer, every BOOST_MS: O(1) whatever is queued. */
+static void boost_fire(Timer *t){
+    Mlfq *m = t->arg;
+    atomic_fetch_add(&m->boost_epoch, 1);
+    atomic_fetch_or(&m->stale, atomic_load(&m->nonempty) & ~1u);
+    timer_add(&wheel, t, ms_ticks(BOOST_MS));
+}
+
+/* A consumer's quantum: it parks on expired until the timer fires. */
+typedef struct Slice {
+    Timer timer;
+    _Atomic uint32_t expired;
+} Slice;
+
+static void slice_fire(Timer *t){
+    Slice *sl = t->arg;
+    atomic_store(&sl->expired, 1);
+    futex_wake(&sl->expired, 1);
+}
+
+static void do_slice(Slice *sl, int slice_ms){
+    atomic_store(&sl->expired, 0);
+    timer_add(&wheel, &sl->timer, ms_ticks(slice_ms));
+    while(!atomic_load(&sl->expired)) futex_wait(&sl->expired, 0, NULL);
+}
+
+/* GREEN: one unit of cost is 1 ms of green_mix() rounds over a hash of
+ * the payload, with a safe point every GREEN_CHECK rounds. Progress lives
+ * on the job's own stack, so a unit cut short resumes where it stopped. */
+static long spins_per_ms = 1;
+
+static void job_body(void *arg){
+    Job *j = arg;
+    uint32_t h = 2166136261u;
+    for(size_t i=0; i<j->payload.len; ++i) h = (h ^ (unsigned char)j->payload.ptr[i]) * 16777619u;
+
+    while(j->cost > 0){
+        for(long r=0; r<spins_per_ms; ++r){
+            h = green_mix(h);
+            if(r % GREEN_CHECK == GREEN_CHECK-1) green_check(j->green);
         }
+        j->cost--;
     }
+    j->sum = h;
 }
 
-static void do_slice(int slice_ms){
-    ms_sleep(slice_ms);
+/* Runs job on this consumer until it finishes or slice_ms is up. Returns
+ * 1 if it finished; *expired says whether it was preempted. */
+static int green_slice(Slice *sl, Job *job, int slice_ms, int *expired){
+    atomic_store(&sl->expired, 0);
+    timer_add(&wheel, &sl->timer, ms_ticks(slice_ms));
+    int done = green_run(job->green, &sl->expired);
+    /* a timer that already left the wheel still fires: wait for it, or it
+     * would cut the next slice short */
+    if(!timer_cancel(&wheel, &sl->timer)){
+        while(!atomic_load(&sl->expired)) futex_wait(&sl->expired, 0, NULL);
+    }
+    *expired = !done;
+    return done;
+}
+
+/* I/O done: the job goes back where it slept from. This runs on the
+ * ticker, which must not block, so a full level means another tick. */
+static void wake_fire(Timer *t){
+    Job *j = t->arg;
+    lat_requeue(&j->times);
+    if(!rs_try_push(j->home, j->level, j)){
+        timer_add(&wheel, t, 1);
+        return;
+    }
+    atomic_fetch_sub(&sleeping, 1);
+    ec_notify(&any_ready, UINT32_MAX);
 }
 
+static void job_sleep(Mlfq *m, Job *j, int lvl, int ms){
+    j->home = m;
+    j->level = lvl;
+    atomic_fetch_add(&sleeping, 1);
+    timer_init(&j->wake, wake_fire, j);
+    timer_add(&wheel, &j->wake, ms_ticks(ms));
+}
+
+static LineReader input;   /* stdin */
+static Trace trace;
+static Trace *replay;      /* &trace if argv[1] named one */
+static JobSource source;
+
 static void* producer(void *arg){
     (void)arg;
-    char buf[256];
-    while(fgets(buf, sizeof buf, stdin)){
-        Job *j = malloc(sizeof *j);
-        if(!j){ perror("malloc job"); exit(1); }
-        j->id = __sync_fetch_and_add(&next_job_id, 1);
-        j->payload = strdup(buf); 
-        j->priority = rand()%100 + 1;
-        j->cost = rand()%40 + 10; 
-
-      
-        rs_push(&queues[0], j);
-    }
-
-
-    int ncons = *(int*)(((void**)arg)[1]); 
-    (void)ncons; 
-    pthread_mutex_lock(&any_mtx);
-    running = 0;
-    pthread_cond_broadcast(&any_not_empty);
-    pthread_mutex_unlock(&any_mtx);
+    JobDraw d;
+    WlPacer pacer;
+    wl_pacer_init(&pacer);
+    while(src_next(&source, &pacer, &d)){
+        Job *j = pool_alloc(sizeof *j);
+        j->id = (int)d.id;
+        j->payload = d.payload;
+        j->priority = d.priority;
+        j->cost = d.cost; 
+        lat_arrive(&j->times, lat_now());
+        if(GREEN){
+            j->green = pool_alloc(sizeof *j->green);
+            green_init(j->green, job_body, j);
+        }
+
+        mlfq_place(j);
+    }
+    /* main stops the consumers once every producer is done */
     return NULL;
 }
 
 static void* consumer(void *arg){
-    (void)arg;
-    for(;;){
-        maybe_boost();
+    Mlfq *me = arg;
+    Slice sl;
+    timer_init(&sl.timer, slice_fire, &sl);
 
+    for(;;){
         int lvl = -1;
-        Job *job = mlfq_pop(&lvl);
+        Job *job = mlfq_pop(me, &lvl);
         if(!job){
             return NULL;
         }
 
+        lat_dispatch(&job->times, lvl);
         int quantum = Quanta[lvl];
         int slice   = min_int(job->cost, quantum);
-
-        do_slice(slice);
-        job->cost -= slice;
+        int io      = IO_PERCENT && wl_range(0, 99) < IO_PERCENT;
+        if(io) slice = wl_range(1, slice);
+
+        if(GREEN){
+            /* preempted by the quantum timer means it used the whole
+             * quantum, however many units it got through */
+            int expired, before = job->cost;
+            green_slice(&sl, job, slice, &expired);
+            slice = (expired && !io) ? quantum : before - job->cost;
+        } else {
+            do_slice(&sl, slice);
+            job->cost -= slice;
+        }
+        lat_ran(&job->times, lvl);
 
         if(job->cost <= 0){
+            lat_done(&job->times, lvl);
             printf("[FIN] job %d (from Q%d)\n", job->id, lvl);
-            free(job->payload);
-            free(job);
+            line_release(&job->payload);
+            if(GREEN) pool_free(job->green);
+            pool_free(job);
+            atomic_fetch_sub(&me->load, 1);
             continue;
         }
 
-        // feedback
-        int new_lvl;
-        if(slice < quantum){
-            new_lvl = (lvl > 0) ? lvl - 1 : 0;
-        }else{
-            new_lvl = (lvl < NUM_LEVELS-1) ? lvl + 1 : lvl;
+        /* stays with this consumer: no need to wake anyone */
+        if(io) job_sleep(me, job, next_level(lvl, slice, quantum), IO_MS);
+        else   rs_push(me, next_level(lvl, slice, quantum), job);
+    }
+}
+
+/* Simulation mode: the same levels, Quanta, feedback and BOOST_MS boost,
+ * driven by des_sim.h. Each level is a FIFO, so a boost is one splice per
+ * level. Everything runs on the main thread, so nothing is locked. */
+typedef struct SimLevel { Job *head, *tail; } SimLevel;
+
+static SimLevel sim_levels[NUM_LEVELS];
+
+static void sim_level_push(int lvl, Job *j){
+    SimLevel *l = &sim_levels[lvl];
+    j->level = lvl;
+    j->next = NULL;
+    if(l->tail) l->tail->next = j; else l->head = j;
+    l->tail = j;
+}
+
+static SimJob* sim_arrive(void *ctx){
+    (void)ctx;
+    JobDraw d;
+    if(!src_next(&source, NULL, &d)) return NULL;
+
+    Job *j = pool_alloc(sizeof *j);
+    j->id = (int)d.id;
+    j->payload = d.payload;
+    j->priority = d.priority;
+    j->cost = d.cost;
+    j->sim.arrival = d.arrival;
+    j->sim.id = j->id;
+    j->sim.service = j->cost;
+    return &j->sim;
+}
+
+static void sim_ready(void *ctx, SimJob *s){
+    (void)ctx;
+    sim_level_push(0, SIM_OWNER(s, Job));
+}
+
+static SimJob* sim_pick(void *ctx, long *slice){
+    (void)ctx;
+    for(int lvl=0; lvl<NUM_LEVELS; ++lvl){
+        SimLevel *l = &sim_levels[lvl];
+        Job *j = l->head;
+        if(!j) continue;
+        l->head = j->next;
+        if(!l->head) l->tail = NULL;
+        *slice = min_int(j->cost, Quanta[lvl]);
+        return &j->sim;
+    }
+    return NULL;
+}
+
+static int sim_ran(void *ctx, SimJob *s, long slice){
+    (void)ctx;
+    Job *j = SIM_OWNER(s, Job);
+    j->cost -= (int)slice;
+    if(j->cost <= 0) return 1;
+    sim_level_push(next_level(j->level, (int)slice, Quanta[j->level]), j);
+    return 0;
+}
+
+static void sim_done(void *ctx, SimJob *s){
+    (void)ctx;
+    Job *j = SIM_OWNER(s, Job);
+    line_release(&j->payload);
+    pool_free(j);
+}
+
+static void sim_boost(void *ctx, long now){
+    (void)ctx; (void)now;
+    SimLevel *top = &sim_levels[0];
+    for(int lvl=1; lvl<NUM_LEVELS; ++lvl){
+        SimLevel *l = &sim_levels[lvl];
+        if(!l->head) continue;
+        for(Job *j = l->head; j; j = j->next) j->level = 0;
+        if(top->tail) top->tail->next = l->head; else top->head = l->head;
+        top->tail = l->tail;
+        l->head = l->tail = NULL;
+    }
+}
+
+static void simulate(void){
+    SimPolicy p = {
+        .ctx = NULL,
+        .arrive = sim_arrive,
+        .ready = sim_ready,
+        .pick = sim_pick,
+        .ran = sim_ran,
+        .done = sim_done,
+        .tick = sim_boost,
+        .tick_period = BOOST_MS,
+        .mean_gap = SIM_MEAN_GAP,
+    };
+    sim_run(&p, NUM_CONS);
+}
+
+#ifdef BENCH
+/* gcc -O2 -DBENCH -pthread MLFQ.c -o mlfq_bench -lm */
+#include <semaphore.h>
+
+#define BENCH_JOBS    64
+#define BENCH_SWITCHES 20000    /* per job */
+#define BENCH_SPAWNS  20000
+
+static double bench_now_ns(void){
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+typedef struct BenchJob {
+    Green g;
+    int left;
+    int idx;
+} BenchJob;
+
+static void bench_body(void *arg){
+    BenchJob *b = arg;
+    while(b->left-- > 0) green_yield(&b->g);
+}
+
+/* Round robin of BENCH_JOBS jobs that give the cpu back at once: one
+ * worker resuming green threads. Returns ns per job-to-job handoff. */
+static double bench_green_switch(void){
+    static BenchJob jobs[BENCH_JOBS];
+    for(int i=0; i<BENCH_JOBS; ++i){
+        jobs[i].left = BENCH_SWITCHES;
+        green_init(&jobs[i].g, bench_body, &jobs[i]);
+    }
+    double t0 = bench_now_ns();
+    for(int live = BENCH_JOBS; live; ){
+        for(int i=0; i<BENCH_JOBS; ++i){
+            if(!jobs[i].g.done && green_run(&jobs[i].g, NULL)) live--;
         }
-        rs_push(&queues[new_lvl], job);
     }
+    return (bench_now_ns() - t0) / ((double)BENCH_JOBS * BENCH_SWITCHES);
+}
+
+/* The same round robin with a thread per job: each waits for its turn on
+ * its own semaphore and passes the turn on. */
+static sem_t bench_turn[BENCH_JOBS];
+
+static void* bench_thread(void *arg){
+    BenchJob *b = arg;
+    int next = (b->idx + 1) % BENCH_JOBS;
+    for(int k=0; k<BENCH_SWITCHES; ++k){
+        sem_wait(&bench_turn[b->idx]);
+        sem_post(&bench_turn[next]);
+    }
+    return NULL;
+}
+
+static double bench_thread_switch(void){
+    static BenchJob jobs[BENCH_JOBS];
+    pthread_t tid[BENCH_JOBS];
+    for(int i=0; i<BENCH_JOBS; ++i){
+        jobs[i].idx = i;
+        sem_init(&bench_turn[i], 0, 0);
+        if(pthread_create(&tid[i], NULL, bench_thread, &jobs[i])!=0){ perror("pthread_create"); exit(1); }
+    }
+    double t0 = bench_now_ns();
+    sem_post(&bench_turn[0]);
+    for(int i=0; i<BENCH_JOBS; ++i) pthread_join(tid[i], NULL);
+    double ns = (bench_now_ns() - t0) / ((double)BENCH_JOBS * BENCH_SWITCHES);
+    for(int i=0; i<BENCH_JOBS; ++i) sem_destroy(&bench_turn[i]);
+    return ns;
+}
+
+/* Starting and finishing an empty job: a green thread on a cached stack
+ * against pthread_create() + pthread_join(). */
+static void* bench_empty(void *arg){ return arg; }
+
+static void bench_spawn(double *green_ns, double *thread_ns){
+    BenchJob b;
+    double t0 = bench_now_ns();
+    for(int i=0; i<BENCH_SPAWNS; ++i){
+        b.left = 0;
+        green_init(&b.g, bench_body, &b);
+        green_run(&b.g, NULL);
+    }
+    *green_ns = (bench_now_ns() - t0) / BENCH_SPAWNS;
+
+    t0 = bench_now_ns();
+    for(int i=0; i<BENCH_SPAWNS; ++i){
+        pthread_t t;
+        if(pthread_create(&t, NULL, bench_empty, NULL)!=0){ perror("pthread_create"); exit(1); }
+        pthread_join(t, NULL);
+    }
+    *thread_ns = (bench_now_ns() - t0) / BENCH_SPAWNS;
 }
 
 int main(void){
-    srand((unsigned)time(NULL));
+    /* the real scheduler is not run here */
+    (void)producer;
+    (void)consumer;
+    (void)simulate;
+    (void)trace;
+    (void)replay;
+    (void)input;
+    (void)mlfq_init;
+    (void)mlfq_destroy;
+    (void)boost_fire;
+
+    double g_spawn, t_spawn;
+    double g_sw = bench_green_switch();
+    double t_sw = bench_thread_switch();
+    bench_spawn(&g_spawn, &t_spawn);
+
+    printf("%-16s %14s %14s\n", "", "green ns", "pthread ns");
+    printf("%-16s %14.1f %14.1f\n", "switch", g_sw, t_sw);
+    printf("%-16s %14.1f %14.1f\n", "spawn+finish", g_spawn, t_spawn);
+    return 0;
+}
 
-    for(int i=0;i<NUM_LEVELS;++i) rs_init(&queues[i], CAPACITY);
+#elif defined(BENCH_SUITE)
+/* The per-core MLFQs in bench/bench.c's suite: placement, the level scan
+ * and stealing. A job is done the first time it is popped; slices, the
+ * feedback between levels and boosts all run on the timer wheel, which a
+ * queue benchmark leaves out. The MLFQs are the program's globals, so
+ * there is one q at a time. */
+#include "bench/bench.h"
+
+static void* suite_create(int arg, size_t cap){
+    (void)arg; (void)cap;
+    for(int i=0;i<NUM_CONS;++i) mlfq_init(&cores[i]);
+    ec_init(&any_ready);
+    atomic_store(&running, 1);
+    atomic_store(&sleeping, 0);
+    return cores;
+}
+
+static void suite_put(void *q, BenchJob *b){
+    Job *j = (Job*)b->item;
+    (void)q;
+    j->id = (int)b->id;
+    j->payload = b->line;
+    j->priority = b->priority;
+    j->cost = b->cost;
+    mlfq_place(j);
+}
+
+static BenchJob* suite_get(void *q, int self){
+    Mlfq *me = &((Mlfq*)q)[self];
+    int lvl;
+    Job *j = mlfq_pop(me, &lvl);
+    if(!j) return NULL;
+    atomic_fetch_sub(&me->load, 1);
+    return bench_job_of(j);
+}
+
+static void suite_stop(void *q, int ncons){
+    (void)q; (void)ncons;
+    mlfq_stop();
+}
+
+static void suite_destroy(void *q){
+    (void)q;
+    for(int i=0;i<NUM_CONS;++i) mlfq_destroy(&cores[i]);
+}
+
+void bench_register_MLFQ(void){
+    static const BenchCase c = {
+        "MLFQ", "per-core", "MLFQ", 0, BENCH_MAX_THREADS, NUM_CONS, 0, sizeof(Job),
+        suite_create, suite_put, suite_get, suite_stop, suite_destroy,
+    };
+    (void)producer;
+    (void)consumer;
+    (void)simulate;
+    (void)trace;
+    (void)replay;
+    (void)input;
+    (void)boost_fire;
+    bench_add(&c);
+}
+
+#else
+
+/* With a job trace (job_trace.h) as argv[1], jobs are replayed from it
+ * instead of read from stdin. */
+int main(int argc, char **argv){
+    srand((unsigned)time(NULL));
+    wl_seed((uint64_t)time(NULL));
+    if(!SIMULATE) lat_watch("MLFQ", NUM_LEVELS);
+
+    for(int i=0;i<NUM_CONS;++i) mlfq_init(&cores[i]);
+    ec_init(&any_ready);
+    wheel_init(&wheel);
+    for(int i=0;i<NUM_CONS;++i){
+        timer_init(&cores[i].boost, boost_fire, &cores[i]);
+        timer_add(&wheel, &cores[i].boost, ms_ticks(BOOST_MS));
+    }
+    lr_init(&input, STDIN_FILENO);
+    input.shared = NUM_PROD > 1;
+    if(argc > 1){ trace_open(&trace, argv[1]); replay = &trace; }
+    src_init(&source, &input, replay, NUM_PROD, 10, 49, 1, 100);
+    if(GREEN) spins_per_ms = green_calibrate(1000);
+
+    if(SIMULATE){
+        simulate();
+        for(int i=0;i<NUM_CONS;++i) mlfq_destroy(&cores[i]);
+        wheel_destroy(&wheel);
+        if(replay) trace_close(replay);
+        lr_close(&input);
+        return 0;
+    }
 
     pthread_t prod[NUM_PROD], cons[NUM_CONS];
 
@@ -198,16 +766,19 @@ int main(void){
         if(pthread_create(&prod[k], NULL, producer, NULL)!=0){ perror("pthread_create prod"); exit(1); }
 
     for(int i=0;i<NUM_CONS;++i)
-        if(pthread_create(&cons[i], NULL, consumer, NULL)!=0){ perror("pthread_create cons"); exit(1); }
+        if(pthread_create(&cons[i], NULL, consumer, &cores[i])!=0){ perror("pthread_create cons"); exit(1); }
 
     for(int k=0;k<NUM_PROD;++k) pthread_join(prod[k], NULL);
-    pthread_mutex_lock(&any_mtx);
-    running = 0;
-    pthread_cond_broadcast(&any_not_empty);
-    pthread_mutex_unlock(&any_mtx);
+    mlfq_stop();
 
     for(int i=0;i<NUM_CONS;++i) pthread_join(cons[i], NULL);
+    if(LAT_STATS) lat_report(stderr, "MLFQ", NUM_LEVELS);
 
-    for(int i=0;i<NUM_LEVELS;++i) rs_destroy(&queues[i]);
+    wheel_destroy(&wheel);
+    for(int i=0;i<NUM_CONS;++i) mlfq_destroy(&cores[i]);
+    if(replay) trace_close(replay);
+    lr_close(&input);
     return 0;
 }
+
+#endif
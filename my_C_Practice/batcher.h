@@ -0,0 +1,174 @@
+#ifndef BATCHER_H
+#define BATCHER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+
+/* Producer-side batching: items are collected in a Batcher and handed to
+ * the queue BATCH_MAX at a time, so the queue lock and the consumer wakeup
+ * are paid once per batch instead of once per item. A small flusher thread
+ * publishes a partial batch once its oldest item has waited LINGER_US, so
+ * at low load an item is delayed by about LINGER_US at most.
+ *
+ * Only the owning producer adds, and filling a batch takes no lock: the
+ * item goes in its slot and one CAS on n makes it part of the batch.
+ * Whoever publishes a batch first claims it by setting BATCH_TAKEN in n,
+ * so the producer and the flusher never flush at once and the queue still
+ * sees one producer at a time (single_prod_cons.c's ring relies on that).
+ * The flusher sleeps without a timeout while the batch is empty, until
+ * the first item of the next one; it takes mtx only to sleep and to hand
+ * a stolen batch back, never across a flush, which may block on a full
+ * queue. */
+
+#ifndef BATCH_MAX
+#define BATCH_MAX 32
+#endif
+
+#ifndef LINGER_US
+#define LINGER_US 1000
+#endif
+
+#define BATCH_TAKEN ((size_t)1 << (sizeof(size_t) * 8 - 1))
+
+typedef void (*batch_flush_fn)(void *q, void **items, size_t n);
+
+typedef struct Batcher {
+    void *q;
+    batch_flush_fn flush;
+    void *items[BATCH_MAX];
+    _Atomic size_t n;               /* items in the batch, | BATCH_TAKEN */
+    _Atomic uint64_t first;         /* ns, CLOCK_MONOTONIC: items[0] added */
+    _Atomic int idle;               /* flusher asleep with no timeout */
+    int stop;
+    pthread_mutex_t mtx;
+    pthread_cond_t  wake;           /* flusher: a batch started, or stop */
+    pthread_cond_t  done;           /* producer: a stolen batch went out */
+    pthread_t flusher;
+} Batcher;
+
+static inline uint64_t batcher_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+/* Publishes items[0..n) if they are still the batch; 0 if someone else
+ * got to them first. */
+static inline int batcher_take(Batcher *b, size_t n) {
+    if (!atomic_compare_exchange_strong(&b->n, &n, n | BATCH_TAKEN)) return 0;
+    b->flush(b->q, b->items, n);
+    return 1;
+}
+
+/* producer: waits out a flush of a batch the flusher stole */
+static inline void batcher_wait(Batcher *b) {
+    pthread_mutex_lock(&b->mtx);
+    while (atomic_load(&b->n) & BATCH_TAKEN) pthread_cond_wait(&b->done, &b->mtx);
+    pthread_mutex_unlock(&b->mtx);
+}
+
+static inline void *batcher_flusher(void *arg) {
+    Batcher *b = arg;
+
+    pthread_mutex_lock(&b->mtx);
+    while (!b->stop) {
+        size_t n = atomic_load(&b->n);
+        if (n == 0 || (n & BATCH_TAKEN)) {
+            /* idle is raised before n is read again and read by
+             * batcher_add() after it starts a batch, so one side sees the
+             * other */
+            atomic_store(&b->idle, 1);
+            n = atomic_load(&b->n);
+            if ((n == 0 || (n & BATCH_TAKEN)) && !b->stop) pthread_cond_wait(&b->wake, &b->mtx);
+            atomic_store(&b->idle, 0);
+            continue;
+        }
+
+        uint64_t due = atomic_load(&b->first) + LINGER_US * 1000ull;
+        if (batcher_now() < due) {
+            struct timespec ts = { (time_t)(due / 1000000000u), (long)(due % 1000000000u) };
+            pthread_cond_timedwait(&b->wake, &b->mtx, &ts);
+            continue;
+        }
+
+        pthread_mutex_unlock(&b->mtx);
+        int took = batcher_take(b, n);
+        pthread_mutex_lock(&b->mtx);
+        if (took) {
+            atomic_store(&b->n, 0);
+            pthread_cond_broadcast(&b->done);
+        }
+    }
+    pthread_mutex_unlock(&b->mtx);
+    return NULL;
+}
+
+static inline void batcher_init(Batcher *b, void *q, batch_flush_fn flush) {
+    pthread_condattr_t attr;
+
+    b->q = q;
+    b->flush = flush;
+    atomic_init(&b->n, 0);
+    atomic_init(&b->first, 0);
+    atomic_init(&b->idle, 0);
+    b->stop = 0;
+    pthread_mutex_init(&b->mtx, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&b->wake, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_cond_init(&b->done, NULL);
+    if (pthread_create(&b->flusher, NULL, batcher_flusher, b) != 0) {
+        perror("pthread_create flusher");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Owning producer only. */
+static inline void batcher_add(Batcher *b, void *item) {
+    size_t n = atomic_load(&b->n);
+    if (n & BATCH_TAKEN) {
+        batcher_wait(b);
+        n = 0;
+    }
+    for (;;) {
+        b->items[n] = item;
+        if (n == 0) atomic_store_explicit(&b->first, batcher_now(), memory_order_relaxed);
+        if (atomic_compare_exchange_strong(&b->n, &n, n + 1)) break;
+        /* the flusher took items[0..n); this one was not among them */
+        batcher_wait(b);
+        n = 0;
+    }
+
+    if (n == 0 && atomic_load(&b->idle)) {
+        pthread_mutex_lock(&b->mtx);
+        pthread_cond_signal(&b->wake);
+        pthread_mutex_unlock(&b->mtx);
+    }
+    if (n + 1 == BATCH_MAX && batcher_take(b, BATCH_MAX)) atomic_store(&b->n, 0);
+}
+
+/* Publishes whatever is left and stops the flusher. */
+static inline void batcher_close(Batcher *b) {
+    size_t n;
+    while ((n = atomic_load(&b->n)) != 0) {
+        if (n & BATCH_TAKEN)              batcher_wait(b);
+        else if (batcher_take(b, n))      atomic_store(&b->n, 0);
+    }
+
+    pthread_mutex_lock(&b->mtx);
+    b->stop = 1;
+    pthread_cond_signal(&b->wake);
+    pthread_mutex_unlock(&b->mtx);
+
+    pthread_join(b->flusher, NULL);
+    pthread_cond_destroy(&b->done);
+    pthread_cond_destroy(&b->wake);
+    pthread_mutex_destroy(&b->mtx);
+}
+
+#endif
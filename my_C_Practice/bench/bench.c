@@ -0,0 +1,317 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "bench.h"
+#include "../job_pool.h"
+#include "../workload.h"
+
+/* Scheduler benchmark suite: every queue and policy of the programs next
+ * door, behind bench.h's BenchCase, swept over producers, consumers,
+ * capacity and payload size.
+ *
+ * gcc -O2 -pthread -DBENCH_SUITE bench/bench.c single_prod_cons.c \
+ *     mult_cons_prod.c scheduling_policies.c simulated_RR.c MLFQ.c -o sched_suite -lm
+ *
+ *   ./sched_suite [-p 1,2,4] [-c 1,2,4] [-q 64,1024] [-s 16,512]
+ *                 [-n jobs] [-m match] [-f csv|json]
+ *
+ * -m keeps the cases whose program/variant/policy contains match. Sweep
+ * points a case cannot take (a second producer for the SPSC ring, more
+ * consumers than a work-stealing scheduler has queues) are skipped, and a
+ * case with a fixed capacity runs once per point and reports capacity 0.
+ *
+ * Each run pushes n jobs through one case and reports, one row per run:
+ * throughput, the p50/p99/p999 of enqueue-to-dequeue latency, context
+ * switches (voluntary and not, from getrusage()) and cpu per job. A
+ * consumer reads every payload byte, so payload size costs what it would
+ * for a real consumer. Rows go to stdout, as CSV or as a JSON array, to be
+ * kept and compared between builds; progress goes to stderr.
+ *
+ * priority_inversion.c has no queue and is not part of the suite. */
+
+#define SUITE_MAX_CASES 64
+#define SUITE_MAX_POINTS 16
+
+static BenchCase cases[SUITE_MAX_CASES];
+static int ncases;
+
+void bench_add(const BenchCase *c) {
+    if (ncases == SUITE_MAX_CASES) {
+        fprintf(stderr, "too many bench cases\n");
+        exit(EXIT_FAILURE);
+    }
+    cases[ncases++] = *c;
+}
+
+typedef struct Sweep {
+    int v[SUITE_MAX_POINTS];
+    int n;
+} Sweep;
+
+typedef struct Run {
+    const BenchCase *c;
+    void *q;
+    int nprod, ncons;
+    size_t payload;
+    long jobs;
+    uint64_t *lat[BENCH_MAX_THREADS];   /* per consumer */
+    long got[BENCH_MAX_THREADS];
+    _Atomic long next_id;
+} Run;
+
+typedef struct Worker {
+    Run *run;
+    int self;
+} Worker;
+
+typedef struct Result {
+    double seconds;
+    uint64_t p50, p99, p999;
+    long ctx_switches;
+    double cpu_ns;                      /* per job */
+} Result;
+
+static _Atomic uint64_t suite_sink;
+
+static uint64_t suite_now_ns(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000u + (uint64_t)t.tv_nsec;
+}
+
+static void *suite_producer(void *arg) {
+    Worker *w = arg;
+    Run *r = w->run;
+    size_t head = sizeof(BenchJob) + ((r->c->item_size + 15) & ~(size_t)15);
+    long n = r->jobs / r->nprod + (w->self < r->jobs % r->nprod);
+
+    for (long k = 0; k < n; k++) {
+        BenchJob *job = pool_alloc(head + r->payload);
+        char *data = (char *)job + head;
+        job->id = atomic_fetch_add_explicit(&r->next_id, 1, memory_order_relaxed);
+        job->cost = wl_range(1, 10);
+        job->priority = wl_range(1, 100);
+        memset(data, (int)job->id, r->payload);
+        job->line = (Line){ data, r->payload, NULL, job->id };
+        job->enq_ns = suite_now_ns();
+        r->c->put(r->q, job);
+    }
+    return NULL;
+}
+
+static void *suite_consumer(void *arg) {
+    Worker *w = arg;
+    Run *r = w->run;
+    uint64_t *lat = r->lat[w->self];
+    uint64_t sum = 0;
+    long n = 0;
+    BenchJob *job;
+
+    while ((job = r->c->get(r->q, w->self))) {
+        lat[n++] = suite_now_ns() - job->enq_ns;
+        for (size_t i = 0; i < job->line.len; i++) sum += (unsigned char)job->line.ptr[i];
+        pool_free(job);
+    }
+    pool_flush();
+    r->got[w->self] = n;
+    atomic_fetch_add(&suite_sink, sum);
+    return NULL;
+}
+
+static double tv_ns(struct timeval t) {
+    return t.tv_sec * 1e9 + t.tv_usec * 1e3;
+}
+
+static int u64_cmp(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static uint64_t pct(const uint64_t *v, long n, double p) {
+    long i = (long)(p * (double)(n - 1) + 0.5);
+    return v[i];
+}
+
+static void spawn(pthread_t *t, void *(*fn)(void *), void *arg) {
+    if (pthread_create(t, NULL, fn, arg) != 0) {
+        perror("pthread_create");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static Result run_one(const BenchCase *c, int nprod, int ncons, size_t cap,
+                      size_t payload, long jobs, uint64_t *lat_buf) {
+    static Run r;
+    pthread_t prod[BENCH_MAX_THREADS], cons[BENCH_MAX_THREADS];
+    Worker pw[BENCH_MAX_THREADS], cw[BENCH_MAX_THREADS];
+    struct rusage ru0, ru1;
+    Result res;
+
+    r.c = c;
+    r.q = c->create(c->arg, cap);
+    r.nprod = nprod;
+    r.ncons = ncons;
+    r.payload = payload;
+    r.jobs = jobs;
+    atomic_init(&r.next_id, 0);
+    for (int i = 0; i < ncons; i++) {
+        r.lat[i] = lat_buf + (size_t)i * (size_t)jobs;
+        r.got[i] = 0;
+    }
+
+    getrusage(RUSAGE_SELF, &ru0);
+    uint64_t t0 = suite_now_ns();
+    for (int i = 0; i < ncons; i++) {
+        cw[i] = (Worker){ &r, i };
+        spawn(&cons[i], suite_consumer, &cw[i]);
+    }
+    for (int k = 0; k < nprod; k++) {
+        pw[k] = (Worker){ &r, k };
+        spawn(&prod[k], suite_producer, &pw[k]);
+    }
+    for (int k = 0; k < nprod; k++) pthread_join(prod[k], NULL);
+    c->stop(r.q, ncons);
+    for (int i = 0; i < ncons; i++) pthread_join(cons[i], NULL);
+    res.seconds = (suite_now_ns() - t0) / 1e9;
+    getrusage(RUSAGE_SELF, &ru1);
+    c->destroy(r.q);
+
+    /* gather every consumer's samples at the front of lat_buf */
+    long n = 0;
+    for (int i = 0; i < ncons; i++) {
+        memmove(lat_buf + n, r.lat[i], (size_t)r.got[i] * sizeof *lat_buf);
+        n += r.got[i];
+    }
+    if (n != jobs) {
+        fprintf(stderr, "%s/%s/%s: %ld of %ld jobs came out\n",
+                c->program, c->variant, c->policy, n, jobs);
+        exit(EXIT_FAILURE);
+    }
+    qsort(lat_buf, (size_t)n, sizeof *lat_buf, u64_cmp);
+    res.p50 = pct(lat_buf, n, 0.50);
+    res.p99 = pct(lat_buf, n, 0.99);
+    res.p999 = pct(lat_buf, n, 0.999);
+    res.ctx_switches = (ru1.ru_nvcsw - ru0.ru_nvcsw) + (ru1.ru_nivcsw - ru0.ru_nivcsw);
+    res.cpu_ns = (tv_ns(ru1.ru_utime) - tv_ns(ru0.ru_utime) +
+                  tv_ns(ru1.ru_stime) - tv_ns(ru0.ru_stime)) / jobs;
+    return res;
+}
+
+static void parse_sweep(Sweep *s, const char *arg, int lo, int hi) {
+    char *end;
+    s->n = 0;
+    for (const char *p = arg; *p; p = end + (*end == ',')) {
+        long v = strtol(p, &end, 10);
+        if (end == p || v < lo || v > hi || s->n == SUITE_MAX_POINTS) {
+            fprintf(stderr, "bad list \"%s\": %d..%d, at most %d values\n",
+                    arg, lo, hi, SUITE_MAX_POINTS);
+            exit(EXIT_FAILURE);
+        }
+        s->v[s->n++] = (int)v;
+    }
+}
+
+static int matches(const BenchCase *c, const char *m) {
+    return !m || strstr(c->program, m) || strstr(c->variant, m) || strstr(c->policy, m);
+}
+
+int main(int argc, char **argv) {
+    Sweep prods = { { 1, 2, 4 }, 3 };
+    Sweep conss = { { 1, 2, 4 }, 3 };
+    Sweep caps = { { 64, 1024 }, 2 };
+    Sweep sizes = { { 16, 512 }, 2 };
+    long jobs = 50000;
+    const char *match = NULL;
+    int json = 0, opt;
+
+    while ((opt = getopt(argc, argv, "p:c:q:s:n:m:f:")) != -1) {
+        switch (opt) {
+        case 'p': parse_sweep(&prods, optarg, 1, BENCH_MAX_THREADS); break;
+        case 'c': parse_sweep(&conss, optarg, 1, BENCH_MAX_THREADS); break;
+        case 'q': parse_sweep(&caps, optarg, 1, 1 << 24); break;
+        case 's': parse_sweep(&sizes, optarg, 0, 1 << 20); break;
+        case 'n': jobs = atol(optarg); break;
+        case 'm': match = optarg; break;
+        case 'f': json = strcmp(optarg, "json") == 0; break;
+        default:
+            fprintf(stderr, "usage: %s [-p list] [-c list] [-q list] [-s list] "
+                            "[-n jobs] [-m match] [-f csv|json]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (jobs < 1) {
+        fprintf(stderr, "-n: need at least one job\n");
+        return EXIT_FAILURE;
+    }
+
+    bench_register_single_prod_cons();
+    bench_register_mult_cons_prod();
+    bench_register_scheduling_policies();
+    bench_register_simulated_RR();
+    bench_register_MLFQ();
+    wl_seed(1);
+
+    int most_cons = 1;
+    for (int i = 0; i < conss.n; i++) {
+        if (conss.v[i] > most_cons) most_cons = conss.v[i];
+    }
+    uint64_t *lat_buf = malloc((size_t)most_cons * (size_t)jobs * sizeof *lat_buf);
+    if (!lat_buf) {
+        perror("malloc latencies");
+        return EXIT_FAILURE;
+    }
+
+    if (json) printf("[");
+    else      printf("program,variant,policy,producers,consumers,capacity,payload,jobs,"
+                     "seconds,jobs_per_s,p50_ns,p99_ns,p999_ns,ctx_switches,cpu_ns_per_job\n");
+    int rows = 0;
+
+    for (int ci = 0; ci < ncases; ci++) {
+        const BenchCase *c = &cases[ci];
+        if (!matches(c, match)) continue;
+
+        for (int pi = 0; pi < prods.n; pi++)
+        for (int qi = 0; qi < conss.n; qi++)
+        for (int ki = 0; ki < (c->has_cap ? caps.n : 1); ki++)
+        for (int si = 0; si < sizes.n; si++) {
+            int np = prods.v[pi], nc = conss.v[qi];
+            size_t cap = c->has_cap ? (size_t)caps.v[ki] : 0;
+            if (np > c->max_prod || nc > c->max_cons) continue;
+
+            fprintf(stderr, "%s/%s/%s p=%d c=%d q=%zu s=%d\n",
+                    c->program, c->variant, c->policy, np, nc, cap, sizes.v[si]);
+            Result r = run_one(c, np, nc, cap ? cap : 1024, (size_t)sizes.v[si], jobs, lat_buf);
+
+            if (json) {
+                printf("%s\n  {\"program\": \"%s\", \"variant\": \"%s\", \"policy\": \"%s\", "
+                       "\"producers\": %d, \"consumers\": %d, \"capacity\": %zu, \"payload\": %d, "
+                       "\"jobs\": %ld, \"seconds\": %.6f, \"jobs_per_s\": %.0f, "
+                       "\"p50_ns\": %llu, \"p99_ns\": %llu, \"p999_ns\": %llu, "
+                       "\"ctx_switches\": %ld, \"cpu_ns_per_job\": %.1f}",
+                       rows ? "," : "", c->program, c->variant, c->policy, np, nc, cap,
+                       sizes.v[si], jobs, r.seconds, jobs / r.seconds,
+                       (unsigned long long)r.p50, (unsigned long long)r.p99,
+                       (unsigned long long)r.p999, r.ctx_switches, r.cpu_ns);
+            } else {
+                printf("%s,%s,%s,%d,%d,%zu,%d,%ld,%.6f,%.0f,%llu,%llu,%llu,%ld,%.1f\n",
+                       c->program, c->variant, c->policy, np, nc, cap, sizes.v[si], jobs,
+                       r.seconds, jobs / r.seconds, (unsigned long long)r.p50,
+                       (unsigned long long)r.p99, (unsigned long long)r.p999,
+                       r.ctx_switches, r.cpu_ns);
+            }
+            fflush(stdout);
+            rows++;
+        }
+    }
+    if (json) printf("\n]\n");
+
+    free(lat_buf);
+    return 0;
+}
@@ -0,0 +1,67 @@
+#ifndef BENCH_SUITE_H
+#define BENCH_SUITE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../line_reader.h"
+
+/* The interface between bench.c's runner and the queues it measures.
+ *
+ * Built with -DBENCH_SUITE, each program leaves out its main() and instead
+ * defines bench_register_<program>(), which hands the runner one BenchCase
+ * per queue variant and policy it has. A case wraps the program's own
+ * insert/remove code: the runner never sees a ReadySet or a Job, only
+ * BenchJobs going in at put() and coming out of get().
+ *
+ * The runner allocates every BenchJob, with item_size bytes in it for the
+ * element the case actually queues (a Line, or the program's Job), and the
+ * payload after that. put() fills in the element from the BenchJob's
+ * fields and queues it; get() turns an element back into its BenchJob with
+ * bench_job_of(). Nothing is allocated or freed inside a case, so all of
+ * it is timed the same way.
+ *
+ * A job counts as dequeued when get() returns it. Policies that run a job
+ * in slices (RR) requeue it inside get() until it has none left, so their
+ * latency is to the last slice. */
+
+#define BENCH_MAX_THREADS 64
+
+typedef struct BenchJob {
+    uint64_t enq_ns;                    /* stamped just before put() */
+    long id;
+    int cost;                           /* 1..10 */
+    int priority;                       /* 1..100 */
+    Line line;                          /* the payload */
+    _Alignas(16) char item[];           /* the case's element, then payload */
+} BenchJob;
+
+#define bench_job_of(elem) ((BenchJob *)((char *)(elem) - offsetof(BenchJob, item)))
+
+typedef struct BenchCase {
+    const char *program;
+    const char *variant;                /* which queue, e.g. "spsc" */
+    const char *policy;                 /* "-" for plain FIFOs */
+    int arg;                            /* for create(), e.g. the policy */
+    int max_prod, max_cons;
+    int has_cap;                        /* 0: capacity is fixed inside */
+    size_t item_size;
+
+    void *(*create)(int arg, size_t cap);
+    void (*put)(void *q, BenchJob *job);
+    /* consumer is 0..ncons-1; NULL once stop() ran and q is drained */
+    BenchJob *(*get)(void *q, int consumer);
+    /* every producer is done: make each of ncons consumers' get() end */
+    void (*stop)(void *q, int ncons);
+    void (*destroy)(void *q);
+} BenchCase;
+
+void bench_add(const BenchCase *c);
+
+void bench_register_single_prod_cons(void);
+void bench_register_mult_cons_prod(void);
+void bench_register_scheduling_policies(void);
+void bench_register_simulated_RR(void);
+void bench_register_MLFQ(void);
+
+#endif
@@ -0,0 +1,244 @@
+#ifndef DES_SIM_H
+#define DES_SIM_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "out_writer.h"
+
+/* Discrete-event simulation of a scheduler on a virtual clock.
+ *
+ * Instead of running (or sleeping through) every slice, sim_run() keeps a
+ * single clock and a 4-ary min-heap of pending events ordered by (time,
+ * seq): the next arrival, the end of the slice each virtual CPU is running
+ * and an optional periodic tick (MLFQ's priority boost). It pops the
+ * earliest event, jumps the clock to it and lets the policy react; once
+ * every event due at that instant has been handled, idle CPUs are handed
+ * the policy's next pick. Nothing ever waits, so the cost is a few heap
+ * operations per slice whatever the job lengths.
+ *
+ * The policy owns the ready queue and sees jobs only through the callbacks
+ * in SimPolicy; the engine owns the clock and the per-job timestamps, and
+ * reports response (first dispatch - arrival), turnaround (finish -
+ * arrival) and wait (turnaround - service) for every job as it finishes,
+ * then their mean and max. Arrivals are pulled one at a time, at the
+ * times the input gives or mean_gap virtual units apart on average, so
+ * memory stays at the jobs in the system rather than the whole input. */
+
+#define SIM_HEAP_ARITY 4
+
+/* one line per finished job, 0 for the summary only */
+#ifndef SIM_PER_JOB
+#define SIM_PER_JOB 1
+#endif
+
+typedef struct SimJob {
+    long id;
+    long arrival;
+    long first_run;                     /* -1 until first dispatched */
+    long finish;
+    long service;                       /* total cost, set by arrive() */
+} SimJob;
+
+/* the job that embeds s as its member named sim */
+#define SIM_OWNER(s, type) ((type *)((char *)(s) - offsetof(type, sim)))
+
+typedef struct SimPolicy {
+    void *ctx;
+    /* Next job from the input, or NULL once it is exhausted. Fills in id
+     * and service, and arrival if the input has arrival times (a replayed
+     * trace), else -1 for a gap of mean_gap on average; the engine sets
+     * the rest. */
+    SimJob *(*arrive)(void *ctx);
+    /* A new arrival joins the ready queue. */
+    void (*ready)(void *ctx, SimJob *job);
+    /* Takes the job to run next and its slice length; NULL if none. */
+    SimJob *(*pick)(void *ctx, long *slice);
+    /* job has run slice units. Returns 1 if it is finished; otherwise the
+     * policy has put it back on its ready queue. */
+    int (*ran)(void *ctx, SimJob *job, long slice);
+    /* Finished job, already reported; the policy frees it. */
+    void (*done)(void *ctx, SimJob *job);
+    void (*tick)(void *ctx, long now);  /* optional */
+    long tick_period;                   /* 0 = no tick */
+    long mean_gap;                      /* between drawn arrivals; 0 = no gap */
+} SimPolicy;
+
+enum sim_event { SIM_ARRIVE, SIM_SLICE_END, SIM_TICK };
+
+typedef struct SimEvent {
+    long time;
+    long seq;                           /* FIFO among equal times */
+    SimJob *job;
+    long slice;
+    int kind;
+} SimEvent;
+
+typedef struct SimHeap {
+    SimEvent *ev;
+    size_t count, cap;
+    long seq;
+} SimHeap;
+
+static inline int sim_before(const SimEvent *a, const SimEvent *b) {
+    if (a->time != b->time) return a->time < b->time;
+    return a->seq < b->seq;
+}
+
+static inline void sim_push(SimHeap *h, long time, int kind, SimJob *job, long slice) {
+    if (h->count == h->cap) {
+        h->cap = h->cap ? 2 * h->cap : 64;
+        h->ev = realloc(h->ev, h->cap * sizeof *h->ev);
+        if (!h->ev) {
+            perror("realloc events");
+            exit(EXIT_FAILURE);
+        }
+    }
+    SimEvent e = { time, h->seq++, job, slice, kind };
+    size_t i = h->count++;
+    while (i > 0) {
+        size_t parent = (i - 1) / SIM_HEAP_ARITY;
+        if (!sim_before(&e, &h->ev[parent])) break;
+        h->ev[i] = h->ev[parent];
+        i = parent;
+    }
+    h->ev[i] = e;
+}
+
+static inline SimEvent sim_pop(SimHeap *h) {
+    SimEvent top = h->ev[0];
+    size_t n = --h->count;
+    SimEvent last = h->ev[n];
+    size_t i = 0;
+
+    for (;;) {
+        size_t first = i * SIM_HEAP_ARITY + 1;
+        if (first >= n) break;
+        size_t end = first + SIM_HEAP_ARITY < n ? first + SIM_HEAP_ARITY : n;
+        size_t best = first;
+        for (size_t c = first + 1; c < end; c++) {
+            if (sim_before(&h->ev[c], &h->ev[best])) best = c;
+        }
+        if (!sim_before(&h->ev[best], &last)) break;
+        h->ev[i] = h->ev[best];
+        i = best;
+    }
+    if (n > 0) h->ev[i] = last;
+    return top;
+}
+
+typedef struct SimMetric {
+    double sum;
+    long max;
+} SimMetric;
+
+static inline void sim_metric_add(SimMetric *m, long v) {
+    m->sum += (double)v;
+    if (v > m->max) m->max = v;
+}
+
+static inline long sim_next_gap(long mean) {
+    return mean > 0 ? rand() % (2 * mean + 1) : 0;
+}
+
+/* Arrival time of a job arriving after now: its own, but never in the
+ * past, or a drawn gap. */
+static inline void sim_arrival(SimJob *j, long now, long mean_gap) {
+    if (j->arrival < 0)        j->arrival = now + sim_next_gap(mean_gap);
+    else if (j->arrival < now) j->arrival = now;
+}
+
+/* Runs p on ncpu virtual CPUs until the input is exhausted and every job
+ * has finished. Returns the number of jobs simulated. */
+static long sim_run(const SimPolicy *p, int ncpu) {
+    static Writer out;
+    SimHeap h = { NULL, 0, 0, 0 };
+    SimMetric response = { 0, 0 }, turnaround = { 0, 0 }, wait = { 0, 0 };
+    long now = 0, jobs = 0, live = 0;
+    int idle = ncpu;
+    struct timespec t0, t1;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    out_init(&out, STDOUT_FILENO);
+
+    SimJob *next = p->arrive(p->ctx);
+    if (next) {
+        sim_arrival(next, 0, p->mean_gap);
+        sim_push(&h, next->arrival, SIM_ARRIVE, next, 0);
+    }
+    if (p->tick_period > 0) sim_push(&h, p->tick_period, SIM_TICK, NULL, 0);
+
+    while (h.count) {
+        SimEvent e = sim_pop(&h);
+        now = e.time;
+
+        switch (e.kind) {
+        case SIM_ARRIVE:
+            e.job->first_run = -1;
+            live++;
+            p->ready(p->ctx, e.job);
+            if ((next = p->arrive(p->ctx))) {
+                sim_arrival(next, now, p->mean_gap);
+                sim_push(&h, next->arrival, SIM_ARRIVE, next, 0);
+            }
+            break;
+
+        case SIM_SLICE_END:
+            idle++;
+            if (p->ran(p->ctx, e.job, e.slice)) {
+                SimJob *j = e.job;
+                j->finish = now;
+                long resp = j->first_run - j->arrival;
+                long turn = j->finish - j->arrival;
+                sim_metric_add(&response, resp);
+                sim_metric_add(&turnaround, turn);
+                sim_metric_add(&wait, turn - j->service);
+                if (SIM_PER_JOB) {
+                    out_printf(&out, "job %ld arrival %ld response %ld turnaround %ld wait %ld\n",
+                               j->id, j->arrival, resp, turn, turn - j->service);
+                }
+                live--;
+                jobs++;
+                p->done(p->ctx, j);
+            }
+            break;
+
+        case SIM_TICK:
+            p->tick(p->ctx, now);
+            /* only while there is something left to tick for */
+            if (live || next) sim_push(&h, now + p->tick_period, SIM_TICK, NULL, 0);
+            break;
+        }
+
+        /* hand out CPUs once everything due at this instant is in */
+        if (h.count && h.ev[0].time == now) continue;
+        while (idle > 0) {
+            long slice;
+            SimJob *j = p->pick(p->ctx, &slice);
+            if (!j) break;
+            if (j->first_run < 0) j->first_run = now;
+            sim_push(&h, now + slice, SIM_SLICE_END, j, slice);
+            idle--;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double secs = (double)(t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    double n = jobs ? (double)jobs : 1;
+
+    out_printf(&out, "simulated %ld jobs on %d cpus, makespan %ld\n", jobs, ncpu, now);
+    out_printf(&out, "%-12s %12s %10s\n", "", "mean", "max");
+    out_printf(&out, "%-12s %12.2f %10ld\n", "response", response.sum / n, response.max);
+    out_printf(&out, "%-12s %12.2f %10ld\n", "turnaround", turnaround.sum / n, turnaround.max);
+    out_printf(&out, "%-12s %12.2f %10ld\n", "wait", wait.sum / n, wait.max);
+    out_close(&out);
+    fprintf(stderr, "%.3f s wall, %.0f jobs/s\n", secs, secs > 0 ? jobs / secs : 0.0);
+
+    free(h.ev);
+    return jobs;
+}
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef EVENTCOUNT_H
+#define EVENTCOUNT_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+/* Eventcount: lets a thread sleep on "the queue changed" without the
+ * fast path ever taking a lock. A waiter registers, re-checks the queue and
+ * only then sleeps on the epoch it saw. A notifier that finds registered
+ * waiters takes up to n registrations and bumps the epoch in one CAS, then
+ * wakes that many threads, so a burst of pushes against a parked consumer
+ * costs one futex_wake, not one per push. A waiter that cancels or wakes
+ * spuriously only hands its registration back while the epoch is still the
+ * one it registered in: once a notify has run, the registration may have
+ * been taken, and giving back another thread's would leave that thread
+ * asleep with nobody counted to wake it. At worst a registration outlives
+ * its waiter and costs the next notify one needless futex_wake. */
+typedef struct {
+    _Atomic uint64_t state;             /* epoch << 32 | waiters */
+} EventCount;
+
+/* the futex word is the epoch half of state */
+static inline _Atomic uint32_t *ec_epoch(EventCount *ec) {
+    return (_Atomic uint32_t *)&ec->state + (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__);
+}
+
+/* Returns 0 once deadline (absolute CLOCK_MONOTONIC, when not NULL) has
+ * passed, 1 on any other return. */
+static inline int futex_wait(_Atomic uint32_t *addr, uint32_t val, const struct timespec *deadline) {
+    if (!deadline) {
+        syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+        return 1;
+    }
+    return syscall(SYS_futex, addr, FUTEX_WAIT_BITSET_PRIVATE,
+                   val, deadline, NULL, FUTEX_BITSET_MATCH_ANY) == 0 || errno != ETIMEDOUT;
+}
+
+static inline void futex_wake(_Atomic uint32_t *addr, int n) {
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+}
+
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+static inline void ec_init(EventCount *ec) {
+    atomic_init(&ec->state, 0);
+}
+
+static inline uint32_t ec_prepare(EventCount *ec) {
+    return (uint32_t)(atomic_fetch_add(&ec->state, 1) >> 32);
+}
+
+static inline void ec_cancel(EventCount *ec, uint32_t key) {
+    uint64_t s = atomic_load_explicit(&ec->state, memory_order_relaxed);
+    while ((uint32_t)(s >> 32) == key && (uint32_t)s &&
+           !atomic_compare_exchange_weak(&ec->state, &s, s - 1)) {
+    }
+}
+
+/* Returns 0 if deadline (when not NULL) passed first. */
+static inline int ec_wait(EventCount *ec, uint32_t key, const struct timespec *deadline) {
+    int woke = futex_wait(ec_epoch(ec), key, deadline);
+    ec_cancel(ec, key);
+    return woke;
+}
+
+/* Wakes up to n registered waiters. */
+static inline void ec_notify(EventCount *ec, uint32_t n) {
+    atomic_thread_fence(memory_order_seq_cst);
+    uint64_t s = atomic_load_explicit(&ec->state, memory_order_relaxed);
+    while ((uint32_t)s) {
+        uint32_t take = (uint32_t)s < n ? (uint32_t)s : n;
+        uint64_t next = (((s >> 32) + 1) << 32) | ((uint32_t)s - take);
+        if (atomic_compare_exchange_weak(&ec->state, &s, next)) {
+            futex_wake(ec_epoch(ec), (int)take);
+            return;
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,239 @@
+#ifndef GREEN_H
+#define GREEN_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+/* Stackful coroutines ("green threads") for running jobs as real,
+ * resumable work.
+ *
+ * A worker calls green_run() to switch onto a job's own stack; the job runs
+ * until it finishes or calls green_yield(), which switches back. A job is
+ * asked to yield through *preempt, which green_run() points at a flag the
+ * worker's quantum timer sets, and honours it at its next green_check():
+ * preemption is timer-driven but only ever happens at a safe point, so the
+ * job can hold locks or call malloc like any other code.
+ *
+ * A job may be resumed by a different worker than the one that started or
+ * last ran it (work stealing), so nothing below caches thread-local state
+ * across a switch: the worker's context and flag are stored in the Green
+ * by each green_run().
+ *
+ * Stacks are GREEN_STACK_SIZE mmap()s with a PROT_NONE guard page below,
+ * taken only when a job first runs, and kept in a per-thread cache of up to
+ * GREEN_STACK_CACHE when it finishes, so a steady stream of jobs costs no
+ * system calls. */
+
+#ifndef GREEN_STACK_SIZE
+#define GREEN_STACK_SIZE (64 * 1024)
+#endif
+
+#define GREEN_STACK_CACHE 64
+
+typedef struct Green {
+    ucontext_t ctx;
+    ucontext_t *caller;                 /* worker that resumed us last */
+    _Atomic uint32_t *preempt;          /* set: yield at the next check */
+    char *stack;                        /* NULL until first run */
+    void (*fn)(void *);
+    void *arg;
+    int done;
+} Green;
+
+typedef struct GreenThread {
+    ucontext_t sched;
+    Green *starting;
+    char *cache[GREEN_STACK_CACHE];
+    int ncache;
+    _Atomic uint32_t tick;              /* green_timer_*'s preempt flag */
+    timer_t timer;
+    int has_timer;
+} GreenThread;
+
+static __thread GreenThread green_self;
+
+static inline size_t green_page(void) {
+    return (size_t)sysconf(_SC_PAGESIZE);
+}
+
+static inline char *green_stack_get(void) {
+    GreenThread *t = &green_self;
+    if (t->ncache) return t->cache[--t->ncache];
+
+    size_t guard = green_page();
+    char *p = mmap(NULL, GREEN_STACK_SIZE + guard, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (p == MAP_FAILED) {
+        perror("mmap stack");
+        exit(EXIT_FAILURE);
+    }
+    if (mprotect(p, guard, PROT_NONE) != 0) {
+        perror("mprotect guard");
+        exit(EXIT_FAILURE);
+    }
+    return p + guard;
+}
+
+static inline void green_stack_put(char *stack) {
+    GreenThread *t = &green_self;
+    if (t->ncache < GREEN_STACK_CACHE) {
+        t->cache[t->ncache++] = stack;
+        return;
+    }
+    size_t guard = green_page();
+    munmap(stack - guard, GREEN_STACK_SIZE + guard);
+}
+
+static inline void green_init(Green *g, void (*fn)(void *), void *arg) {
+    g->caller = NULL;
+    g->preempt = NULL;
+    g->stack = NULL;
+    g->fn = fn;
+    g->arg = arg;
+    g->done = 0;
+}
+
+static inline void green_entry(void) {
+    /* still on the thread that called green_run() for the first time */
+    Green *g = green_self.starting;
+    g->fn(g->arg);
+    g->done = 1;
+    setcontext(g->caller);
+}
+
+/* Runs g until it yields or finishes, with preempt as its yield flag.
+ * Returns 1 once g has finished; its stack is then back in the cache. */
+static inline int green_run(Green *g, _Atomic uint32_t *preempt) {
+    GreenThread *t = &green_self;
+    g->caller = &t->sched;
+    g->preempt = preempt;
+
+    if (!g->stack) {
+        g->stack = green_stack_get();
+        if (getcontext(&g->ctx) != 0) {
+            perror("getcontext");
+            exit(EXIT_FAILURE);
+        }
+        g->ctx.uc_stack.ss_sp = g->stack;
+        g->ctx.uc_stack.ss_size = GREEN_STACK_SIZE;
+        g->ctx.uc_link = NULL;
+        makecontext(&g->ctx, green_entry, 0);
+        t->starting = g;
+    }
+    if (swapcontext(&t->sched, &g->ctx) != 0) {
+        perror("swapcontext");
+        exit(EXIT_FAILURE);
+    }
+
+    if (g->done) {
+        green_stack_put(g->stack);
+        g->stack = NULL;
+        return 1;
+    }
+    return 0;
+}
+
+/* Called on g's own stack: switches back to whoever ran it. */
+static inline void green_yield(Green *g) {
+    swapcontext(&g->ctx, g->caller);
+}
+
+/* A safe point: yields if the quantum is up. */
+static inline void green_check(Green *g) {
+    if (g->preempt && atomic_load_explicit(g->preempt, memory_order_relaxed)) {
+        green_yield(g);
+    }
+}
+
+/* Stand-in cpu work for jobs that run as green threads: green_mix() is one
+ * round of it, and green_calibrate(us) is how many rounds take us
+ * microseconds on this machine. */
+static inline uint32_t green_mix(uint32_t h) {
+    h ^= h >> 15;
+    h *= 0x2c1b3c6du;
+    h ^= h >> 12;
+    h *= 0x297a2d39u;
+    return h ^ (h >> 15);
+}
+
+static inline long green_calibrate(long us) {
+    const long rounds = 1L << 22;
+    struct timespec t0, t1;
+    volatile uint32_t sink;
+    uint32_t h = 1;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (long r = 0; r < rounds; r++) h = green_mix(h);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    sink = h;
+    (void)sink;
+
+    double ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+    long n = (long)(rounds * (us * 1e3) / ns);
+    return n > 0 ? n : 1;
+}
+
+/* Per-thread quantum timer for workers without a timer of their own: a
+ * CLOCK_THREAD_CPUTIME_ID timer_create() timer whose SIGEV_THREAD_ID
+ * signal sets green_timer_flag() in the handler, so a worker is only
+ * charged for the cpu it got. The kernel checks cpu-time timers on its
+ * scheduler tick, so a quantum can run over by up to one tick. */
+#define GREEN_TIMER_SIG SIGRTMIN
+
+static inline void green_timer_handler(int sig) {
+    (void)sig;
+    atomic_store_explicit(&green_self.tick, 1, memory_order_relaxed);
+}
+
+static inline _Atomic uint32_t *green_timer_flag(void) {
+    return &green_self.tick;
+}
+
+static inline void green_timer_install(void) {
+    struct sigaction sa;
+    sa.sa_handler = green_timer_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(GREEN_TIMER_SIG, &sa, NULL);
+}
+
+/* Call once per worker thread. */
+static inline void green_timer_init(void) {
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, green_timer_install);
+
+    struct sigevent sev;
+    sev.sigev_notify = SIGEV_THREAD_ID;
+    sev.sigev_signo = GREEN_TIMER_SIG;
+    sev.sigev_value.sival_ptr = NULL;
+    sev._sigev_un._tid = (pid_t)syscall(SYS_gettid);
+    if (timer_create(CLOCK_THREAD_CPUTIME_ID, &sev, &green_self.timer) != 0) {
+        perror("timer_create");
+        exit(EXIT_FAILURE);
+    }
+    green_self.has_timer = 1;
+}
+
+/* Arms the quantum timer for us microseconds of this thread's cpu time
+ * (0 disarms it) and clears the flag. */
+static inline void green_timer_arm(long us) {
+    struct itimerspec its = { { 0, 0 }, { us / 1000000, (us % 1000000) * 1000 } };
+    atomic_store_explicit(&green_self.tick, 0, memory_order_relaxed);
+    timer_settime(green_self.timer, 0, &its, NULL);
+}
+
+static inline void green_timer_destroy(void) {
+    if (green_self.has_timer) timer_delete(green_self.timer);
+    green_self.has_timer = 0;
+}
+
+#endif
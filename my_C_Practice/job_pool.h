@@ -0,0 +1,187 @@
+#ifndef JOB_POOL_H
+#define JOB_POOL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+/* Job/payload allocator for the producer/consumer programs.
+ *
+ * Objects come from size-classed slabs (16 B .. 4 KiB). Each thread owns
+ * the slabs it carved and keeps a private free list per class, so an
+ * allocation is a list pop with no atomics. Slabs are POOL_SLAB_SIZE-aligned and
+ * start with a header naming their owner and class, so pool_free() finds
+ * both from the pointer alone. An object freed by any other thread (the
+ * consumer, for everything the producer allocated) is pushed on the
+ * owner's lock-free remote-free stack, POOL_REMOTE_BATCH objects per CAS;
+ * the owner takes the whole stack back with one exchange when its own list
+ * for a class runs dry. Memory therefore circulates producer -> consumer ->
+ * producer and the footprint stays at the peak number of jobs in flight.
+ * Larger objects get a slab of their own and go straight back to the
+ * system. */
+
+#define POOL_SLAB_SIZE  (64 * 1024)
+#define POOL_MIN_SHIFT  4
+#define POOL_CLASSES    9               /* 16, 32, ..., 4096 bytes */
+#define POOL_LARGE      POOL_CLASSES
+#define POOL_REMOTE_BATCH 32
+
+typedef struct PoolObj {
+    struct PoolObj *next;
+} PoolObj;
+
+typedef struct PoolThread {
+    PoolObj *free[POOL_CLASSES];
+    _Atomic(PoolObj *) remote;          /* freed by other threads */
+
+    /* objects this thread freed for another owner, not yet handed back */
+    struct PoolThread *out_owner;
+    PoolObj *out_head, *out_tail;
+    int out_n;
+} PoolThread;
+
+typedef struct PoolSlab {
+    PoolThread *owner;
+    int cls;
+    char pad[64 - sizeof(PoolThread *) - sizeof(int)];
+} PoolSlab;
+
+static __thread PoolThread *pool_self;
+
+static inline PoolThread *pool_thread(void) {
+    if (!pool_self) {
+        /* never freed: other threads may still return objects to it after
+         * this thread has exited */
+        pool_self = calloc(1, sizeof *pool_self);
+        if (!pool_self) {
+            perror("calloc pool");
+            exit(EXIT_FAILURE);
+        }
+    }
+    return pool_self;
+}
+
+static inline int pool_class(size_t size) {
+    int cls = 0;
+    size_t sz = (size_t)1 << POOL_MIN_SHIFT;
+    while (sz < size) {
+        sz <<= 1;
+        if (++cls == POOL_CLASSES) return POOL_LARGE;
+    }
+    return cls;
+}
+
+static inline PoolSlab *pool_slab_of(void *p) {
+    return (PoolSlab *)((uintptr_t)p & ~(uintptr_t)(POOL_SLAB_SIZE - 1));
+}
+
+static inline void *pool_slab_new(PoolThread *t, int cls, size_t bytes) {
+    void *mem;
+    if (posix_memalign(&mem, POOL_SLAB_SIZE, bytes) != 0) {
+        perror("posix_memalign");
+        exit(EXIT_FAILURE);
+    }
+    PoolSlab *slab = mem;
+    slab->owner = t;
+    slab->cls = cls;
+    return slab + 1;
+}
+
+/* Hands everything on the remote stack back to the per-class lists. */
+static inline void pool_reclaim(PoolThread *t) {
+    PoolObj *o = atomic_exchange_explicit(&t->remote, NULL, memory_order_acquire);
+    while (o) {
+        PoolObj *next = o->next;
+        int cls = pool_slab_of(o)->cls;
+        o->next = t->free[cls];
+        t->free[cls] = o;
+        o = next;
+    }
+}
+
+static inline void pool_refill(PoolThread *t, int cls) {
+    size_t obj = (size_t)1 << (cls + POOL_MIN_SHIFT);
+    char *p = pool_slab_new(t, cls, POOL_SLAB_SIZE);
+    char *end = (char *)pool_slab_of(p) + POOL_SLAB_SIZE;
+
+    for (; p + obj <= end; p += obj) {
+        PoolObj *o = (PoolObj *)p;
+        o->next = t->free[cls];
+        t->free[cls] = o;
+    }
+}
+
+static inline void *pool_alloc(size_t size) {
+    PoolThread *t = pool_thread();
+    int cls = pool_class(size);
+
+    if (cls == POOL_LARGE) {
+        return pool_slab_new(t, POOL_LARGE, sizeof(PoolSlab) + size);
+    }
+    if (!t->free[cls]) {
+        pool_reclaim(t);
+        if (!t->free[cls]) pool_refill(t, cls);
+    }
+    PoolObj *o = t->free[cls];
+    t->free[cls] = o->next;
+    return o;
+}
+
+static inline void pool_flush_remote(PoolThread *t) {
+    if (!t->out_n) return;
+
+    PoolThread *owner = t->out_owner;
+    PoolObj *head = atomic_load_explicit(&owner->remote, memory_order_relaxed);
+    do {
+        t->out_tail->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(&owner->remote, &head, t->out_head,
+                 memory_order_release, memory_order_relaxed));
+
+    t->out_head = t->out_tail = NULL;
+    t->out_n = 0;
+}
+
+static inline void pool_free(void *p) {
+    if (!p) return;
+
+    PoolSlab *slab = pool_slab_of(p);
+    if (slab->cls == POOL_LARGE) {
+        free(slab);
+        return;
+    }
+
+    PoolObj *o = p;
+    PoolThread *owner = slab->owner;
+    if (owner == pool_self) {
+        o->next = owner->free[slab->cls];
+        owner->free[slab->cls] = o;
+        return;
+    }
+
+    PoolThread *t = pool_thread();
+    if (t->out_owner != owner) {
+        pool_flush_remote(t);
+        t->out_owner = owner;
+    }
+    o->next = t->out_head;
+    t->out_head = o;
+    if (!t->out_tail) t->out_tail = o;
+    if (++t->out_n == POOL_REMOTE_BATCH) pool_flush_remote(t);
+}
+
+/* Returns this thread's pending remote frees; call before a consumer
+ * blocks or exits so the owner can reuse them. */
+static inline void pool_flush(void) {
+    if (pool_self) pool_flush_remote(pool_self);
+}
+
+static inline char *pool_strdup(const char *s) {
+    size_t n = strlen(s) + 1;
+    char *copy = pool_alloc(n);
+    memcpy(copy, s, n);
+    return copy;
+}
+
+#endif
@@ -0,0 +1,176 @@
+#ifndef JOB_TRACE_H
+#define JOB_TRACE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "line_reader.h"
+
+/* Binary job traces, for runs that can be reproduced and compared.
+ *
+ * A trace file is a TraceHeader, then count fixed-size TraceRecs in arrival
+ * order, then the payload bytes the records point into. Fields are in host
+ * byte order: traces are made (trace_convert.c, from CSV) and replayed on
+ * the same kind of machine.
+ *
+ * The file is mmap'ed read-only with MADV_SEQUENTIAL, so replaying it is a
+ * walk through the page cache: a record is read in place, and its payload
+ * is handed out as a Line pointing into the mapping, with no chunk to
+ * release. Producers share one Trace and take records with one atomic
+ * increment. trace_pace() holds a record back until its arrival offset,
+ * divided by TRACE_SPEED, has passed since the replay started; with
+ * TRACE_SPEED 0 records come as fast as they are asked for. */
+
+/* 0 = as fast as possible, 1 = real time, N = N times faster */
+#ifndef TRACE_SPEED
+#define TRACE_SPEED 0
+#endif
+
+/* a unit of cost in microseconds, for turning arrival offsets into the
+ * simulators' virtual time */
+#ifndef TRACE_UNIT_US
+#define TRACE_UNIT_US 1000
+#endif
+
+#define TRACE_MAGIC   0x4352544aU       /* "JTRC" */
+#define TRACE_VERSION 1
+
+typedef struct TraceHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t count;                     /* records */
+    uint64_t payload_off;               /* file offset of the payload bytes */
+} TraceHeader;
+
+typedef struct TraceRec {
+    uint64_t arrival_us;                /* since the start of the trace */
+    uint64_t deadline_us;               /* relative to arrival, 0 = none */
+    uint64_t payload_off;               /* into the payload bytes */
+    uint32_t payload_len;
+    uint32_t cost;                      /* units of TRACE_UNIT_US */
+    uint32_t priority;
+    uint32_t pad;
+} TraceRec;
+
+_Static_assert(sizeof(TraceHeader) == 24, "TraceHeader layout");
+_Static_assert(sizeof(TraceRec) == 40, "TraceRec layout");
+
+typedef struct Trace {
+    const char *map;
+    size_t size;
+    const TraceRec *recs;
+    const char *payload;
+    uint64_t count;
+    _Atomic uint64_t next;
+    struct timespec start;              /* for trace_pace() */
+} Trace;
+
+/* Maps path and checks it; exits on a bad trace. */
+static inline void trace_open(Trace *t, const char *path) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    if ((size_t)st.st_size < sizeof(TraceHeader)) {
+        fprintf(stderr, "%s: not a trace\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    t->size = (size_t)st.st_size;
+    t->map = mmap(NULL, t->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (t->map == MAP_FAILED) {
+        perror("mmap trace");
+        exit(EXIT_FAILURE);
+    }
+    madvise((void *)t->map, t->size, MADV_SEQUENTIAL);
+
+    const TraceHeader *h = (const TraceHeader *)t->map;
+    uint64_t recs_end = sizeof *h + h->count * sizeof(TraceRec);
+    if (h->magic != TRACE_MAGIC || h->version != TRACE_VERSION ||
+        h->count > t->size / sizeof(TraceRec) || recs_end > h->payload_off ||
+        h->payload_off > t->size) {
+        fprintf(stderr, "%s: not a trace, or a different version\n", path);
+        exit(EXIT_FAILURE);
+    }
+    t->recs = (const TraceRec *)(t->map + sizeof *h);
+    t->payload = t->map + h->payload_off;
+    t->count = h->count;
+    atomic_init(&t->next, 0);
+    clock_gettime(CLOCK_MONOTONIC, &t->start);
+}
+
+/* Next record, or NULL once the trace is exhausted. Safe to call from
+ * several producers. */
+static inline const TraceRec *trace_next(Trace *t) {
+    uint64_t i = atomic_fetch_add_explicit(&t->next, 1, memory_order_relaxed);
+    if (i >= t->count) return NULL;
+
+    const TraceRec *r = &t->recs[i];
+    uint64_t avail = t->size - (size_t)(t->payload - t->map);
+    if (r->payload_len > avail || r->payload_off > avail - r->payload_len) {
+        fprintf(stderr, "trace record %llu: payload out of range\n", (unsigned long long)i);
+        exit(EXIT_FAILURE);
+    }
+    return r;
+}
+
+/* r's payload, as a Line numbered by its record. */
+static inline Line trace_payload(const Trace *t, const TraceRec *r) {
+    Line l = { t->payload + r->payload_off, r->payload_len, NULL, (long)(r - t->recs) };
+    return l;
+}
+
+/* Sleeps until r is due under TRACE_SPEED. */
+static inline void trace_pace(const Trace *t, const TraceRec *r) {
+    if (TRACE_SPEED <= 0) return;
+
+    uint64_t ns = r->arrival_us * 1000 / (TRACE_SPEED > 0 ? TRACE_SPEED : 1);
+    struct timespec due = t->start;
+    due.tv_sec  += (time_t)(ns / 1000000000);
+    due.tv_nsec += (long)(ns % 1000000000);
+    if (due.tv_nsec >= 1000000000L) {
+        due.tv_sec++;
+        due.tv_nsec -= 1000000000L;
+    }
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL) == EINTR) {
+    }
+}
+
+/* The producers' input: the next record of t and its payload, or, with no
+ * trace (t NULL), the next line of in and *rec NULL. Returns 0 at the end. */
+static inline int trace_input(Trace *t, LineReader *in, Line *line, const TraceRec **rec) {
+    *rec = NULL;
+    if (!t) return lr_next(in, line);
+    if (!(*rec = trace_next(t))) return 0;
+    *line = trace_payload(t, *rec);
+    return 1;
+}
+
+/* r's arrival in units of TRACE_UNIT_US, or -1 for none (des_sim.h) */
+static inline long trace_arrival(const TraceRec *r) {
+    return r ? (long)(r->arrival_us / TRACE_UNIT_US) : -1;
+}
+
+static inline int trace_clamp(uint32_t v, int lo, int hi) {
+    if (v < (uint32_t)lo) return lo;
+    if (v > (uint32_t)hi) return hi;
+    return (int)v;
+}
+
+static inline void trace_close(Trace *t) {
+    munmap((void *)t->map, t->size);
+}
+
+#endif
@@ -0,0 +1,275 @@
+#ifndef LAT_HIST_H
+#define LAT_HIST_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+
+/* Latency histograms for the scheduler programs.
+ *
+ * A LatHist is log-bucketed like an HdrHistogram: values below
+ * 2^LAT_SUB_BITS get a bucket each, and every power of two above that is
+ * cut into 2^LAT_SUB_BITS linear buckets, so any nanosecond value up to
+ * 2^64 lands in one of LAT_BUCKETS counters and is reported within 1/32
+ * (about 3%) of what was recorded.
+ *
+ * Each thread records into its own LatSet: one LatHist per metric and
+ * level (an MLFQ queue level; other policies only use level 0). Only the
+ * owning thread writes a set, so a record is a relaxed load and store of
+ * its own counters, with no read-modify-write and no lock. Sets are
+ * pushed on a global list the first time a thread records, and are never
+ * freed, so lat_merge() can sum them at any time: at shutdown, or while
+ * the program runs (lat_watch() prints a snapshot on SIGUSR1). A snapshot
+ * taken mid-run may be off by the records in flight.
+ *
+ * A job carries a JobTimes. Per job the programs record:
+ *   response     arrival to first dispatch
+ *   wait         each stay in a ready queue, at the level it waited in
+ *   slice        each time it ran, at the level it ran at
+ *   turnaround   arrival to completion, at the level it finished in
+ * Time a job spends sleeping on I/O (MLFQ) is neither wait nor slice. */
+
+/* 1 = record and report on stderr at exit, 0 = compiled out */
+#ifndef LAT_STATS
+#define LAT_STATS 1
+#endif
+
+#define LAT_SUB_BITS   5
+#define LAT_SUB        (1 << LAT_SUB_BITS)
+#define LAT_BUCKETS    ((64 - LAT_SUB_BITS + 1) * LAT_SUB)
+#define LAT_MAX_LEVELS 4
+
+enum lat_metric { LAT_RESPONSE, LAT_WAIT, LAT_SLICE, LAT_TURNAROUND, LAT_METRICS };
+
+typedef struct LatHist {
+    _Atomic uint64_t count[LAT_BUCKETS];
+    _Atomic uint64_t n, sum, max;
+} LatHist;
+
+typedef struct LatSet {
+    LatHist h[LAT_METRICS][LAT_MAX_LEVELS];
+    struct LatSet *next;
+} LatSet;
+
+typedef struct JobTimes {
+    uint64_t arrival;
+    uint64_t first_run;                 /* 0 until first dispatched */
+    uint64_t ready;                     /* last went into a ready queue */
+    uint64_t run;                       /* current slice started */
+} JobTimes;
+
+static _Atomic(LatSet *) lat_sets;
+static __thread LatSet *lat_self;
+
+static inline uint64_t lat_ns(const struct timespec *t) {
+    return (uint64_t)t->tv_sec * 1000000000u + (uint64_t)t->tv_nsec;
+}
+
+static inline uint64_t lat_now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return lat_ns(&t);
+}
+
+static inline int lat_index(uint64_t v) {
+    if (v < LAT_SUB) return (int)v;
+    int shift = 63 - __builtin_clzll(v) - LAT_SUB_BITS;
+    return (shift + 1) * LAT_SUB + (int)((v >> shift) & (LAT_SUB - 1));
+}
+
+/* largest value that lands in bucket i */
+static inline uint64_t lat_bucket_max(int i) {
+    if (i < LAT_SUB) return (uint64_t)i;
+    int shift = i / LAT_SUB - 1;
+    uint64_t lo = (uint64_t)(LAT_SUB + i % LAT_SUB) << shift;
+    return lo + ((1ull << shift) - 1);
+}
+
+/* single writer: a relaxed load and store, no atomic add */
+static inline void lat_bump(_Atomic uint64_t *c, uint64_t by) {
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + by,
+                          memory_order_relaxed);
+}
+
+/* Records v into h; h must only ever be written by this thread. */
+static inline void lat_hist_add(LatHist *h, uint64_t v) {
+    lat_bump(&h->count[lat_index(v)], 1);
+    lat_bump(&h->n, 1);
+    lat_bump(&h->sum, v);
+    if (v > atomic_load_explicit(&h->max, memory_order_relaxed)) {
+        atomic_store_explicit(&h->max, v, memory_order_relaxed);
+    }
+}
+
+static inline void lat_hist_reset(LatHist *h) {
+    for (int i = 0; i < LAT_BUCKETS; i++) atomic_init(&h->count[i], 0);
+    atomic_init(&h->n, 0);
+    atomic_init(&h->sum, 0);
+    atomic_init(&h->max, 0);
+}
+
+/* dst += src; dst is private to the caller */
+static inline void lat_hist_merge(LatHist *dst, const LatHist *src) {
+    for (int i = 0; i < LAT_BUCKETS; i++) {
+        uint64_t c = atomic_load_explicit(&src->count[i], memory_order_relaxed);
+        if (c) lat_bump(&dst->count[i], c);
+    }
+    lat_bump(&dst->n, atomic_load_explicit(&src->n, memory_order_relaxed));
+    lat_bump(&dst->sum, atomic_load_explicit(&src->sum, memory_order_relaxed));
+    uint64_t m = atomic_load_explicit(&src->max, memory_order_relaxed);
+    if (m > atomic_load_explicit(&dst->max, memory_order_relaxed)) {
+        atomic_store_explicit(&dst->max, m, memory_order_relaxed);
+    }
+}
+
+/* value at quantile q (0..1), as the top of its bucket but never past max */
+static inline uint64_t lat_hist_pct(const LatHist *h, double q) {
+    uint64_t n = atomic_load_explicit(&h->n, memory_order_relaxed);
+    uint64_t max = atomic_load_explicit(&h->max, memory_order_relaxed);
+    if (n == 0) return 0;
+
+    uint64_t rank = (uint64_t)(q * (double)(n - 1)) + 1, seen = 0;
+    for (int i = 0; i < LAT_BUCKETS; i++) {
+        seen += atomic_load_explicit(&h->count[i], memory_order_relaxed);
+        if (seen >= rank) {
+            uint64_t v = lat_bucket_max(i);
+            return v < max ? v : max;
+        }
+    }
+    return max;
+}
+
+static inline LatSet *lat_thread(void) {
+    if (!lat_self) {
+        /* never freed: lat_merge() may read it after the thread is gone */
+        LatSet *s = calloc(1, sizeof *s);
+        if (!s) {
+            perror("calloc latency histograms");
+            exit(EXIT_FAILURE);
+        }
+        s->next = atomic_load(&lat_sets);
+        while (!atomic_compare_exchange_weak(&lat_sets, &s->next, s)) {
+        }
+        lat_self = s;
+    }
+    return lat_self;
+}
+
+static inline void lat_record(int metric, int level, uint64_t ns) {
+    if (!LAT_STATS) return;
+    lat_hist_add(&lat_thread()->h[metric][level], ns);
+}
+
+/* The job entered the system at arrival (ns, CLOCK_MONOTONIC) and is
+ * queued for the first time. */
+static inline void lat_arrive(JobTimes *t, uint64_t arrival) {
+    t->arrival = t->ready = arrival;
+    t->first_run = 0;
+}
+
+/* Taken off a ready queue at level, to run. */
+static inline void lat_dispatch(JobTimes *t, int level) {
+    if (!LAT_STATS) return;
+    uint64_t now = lat_now();
+    if (!t->first_run) {
+        t->first_run = now;
+        lat_record(LAT_RESPONSE, level, now - t->arrival);
+    }
+    lat_record(LAT_WAIT, level, now - t->ready);
+    t->run = now;
+}
+
+/* Its slice at level is over; it is queued again (or sleeps, or is done). */
+static inline void lat_ran(JobTimes *t, int level) {
+    if (!LAT_STATS) return;
+    uint64_t now = lat_now();
+    lat_record(LAT_SLICE, level, now - t->run);
+    t->ready = now;
+}
+
+/* Back in a ready queue after time away from it (I/O). */
+static inline void lat_requeue(JobTimes *t) {
+    if (LAT_STATS) t->ready = lat_now();
+}
+
+/* Finished, after its last slice at level. */
+static inline void lat_done(JobTimes *t, int level) {
+    if (!LAT_STATS) return;
+    lat_record(LAT_TURNAROUND, level, lat_now() - t->arrival);
+}
+
+/* Every thread's histograms summed into *out (zeroed first). */
+static inline void lat_merge(LatSet *out) {
+    for (int m = 0; m < LAT_METRICS; m++) {
+        for (int l = 0; l < LAT_MAX_LEVELS; l++) lat_hist_reset(&out->h[m][l]);
+    }
+    for (LatSet *s = atomic_load(&lat_sets); s; s = s->next) {
+        for (int m = 0; m < LAT_METRICS; m++) {
+            for (int l = 0; l < LAT_MAX_LEVELS; l++) lat_hist_merge(&out->h[m][l], &s->h[m][l]);
+        }
+    }
+}
+
+/* The merged histograms of the first levels levels, in microseconds. */
+static inline void lat_report(FILE *f, const char *label, int levels) {
+    static const char *names[LAT_METRICS] = { "response", "wait", "slice", "turnaround" };
+    LatSet *all = malloc(sizeof *all);
+    if (!all) {
+        perror("malloc latency report");
+        return;
+    }
+    lat_merge(all);
+
+    fprintf(f, "latency (us), %s\n", label);
+    fprintf(f, "%-12s %5s %10s %10s %10s %10s %10s %10s %10s\n",
+            "", "level", "count", "mean", "p50", "p90", "p99", "p99.9", "max");
+    for (int m = 0; m < LAT_METRICS; m++) {
+        for (int l = 0; l < levels; l++) {
+            const LatHist *h = &all->h[m][l];
+            uint64_t n = atomic_load(&h->n);
+            if (n == 0) continue;
+            fprintf(f, "%-12s %5d %10llu %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+                    names[m], l, (unsigned long long)n, atomic_load(&h->sum) / 1e3 / n,
+                    lat_hist_pct(h, 0.50) / 1e3, lat_hist_pct(h, 0.90) / 1e3,
+                    lat_hist_pct(h, 0.99) / 1e3, lat_hist_pct(h, 0.999) / 1e3,
+                    atomic_load(&h->max) / 1e3);
+        }
+    }
+    free(all);
+}
+
+/* On-demand snapshots: a thread that prints lat_report() to stderr on each
+ * SIGUSR1. Call before starting any other thread, since it blocks SIGUSR1
+ * in the caller for the threads it creates to inherit. */
+static const char *lat_watch_label;
+static int lat_watch_levels;
+
+static inline void *lat_watcher(void *arg) {
+    sigset_t *set = arg;
+    int sig;
+    while (sigwait(set, &sig) == 0) lat_report(stderr, lat_watch_label, lat_watch_levels);
+    return NULL;
+}
+
+static inline void lat_watch(const char *label, int levels) {
+    static sigset_t set;
+    pthread_t t;
+
+    if (!LAT_STATS) return;
+    lat_watch_label = label;
+    lat_watch_levels = levels;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+    if (pthread_create(&t, NULL, lat_watcher, &set) != 0) {
+        perror("pthread_create latency watcher");
+        exit(EXIT_FAILURE);
+    }
+    pthread_detach(t);
+}
+
+#endif
@@ -0,0 +1,280 @@
+#ifndef LINE_READER_H
+#define LINE_READER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Zero-copy line input for the producer/consumer programs.
+ *
+ * A LineReader cuts its input into Lines: a (ptr, len) view, newline
+ * included, into a shared Chunk. When the input is a regular file it is
+ * mmap'ed LR_MAP_WINDOW bytes at a time, the next window starting at the
+ * page holding the first unfinished line; otherwise it is read()
+ * LR_CHUNK_SIZE bytes at a time and only a line that straddles the end of a
+ * chunk is copied, into the start of the next one. Either way a chunk grows
+ * to fit, so a line of any length stays one Line.
+ *
+ * A chunk is freed (or unmapped) when the reader has moved past it and the
+ * last Line cut from it is released. The count starts at LR_CHUNK_BIAS and
+ * the reader takes back the bias minus the lines it handed out when it
+ * retires the chunk, so the producer side costs no atomics; each
+ * line_release() is one atomic decrement.
+ *
+ * Set shared when several producer threads call lr_next() on one reader;
+ * a single producer takes no lock. */
+
+#ifndef LR_CHUNK_SIZE
+#define LR_CHUNK_SIZE (1024 * 1024)
+#endif
+
+#ifndef LR_MAP_WINDOW
+#define LR_MAP_WINDOW (64 * 1024 * 1024)
+#endif
+
+#define LR_CHUNK_BIAS (LONG_MAX / 2)
+
+typedef struct Chunk {
+    _Atomic long refs;
+    char *data;
+    size_t cap;
+    int mapped;
+} Chunk;
+
+typedef struct Line {
+    const char *ptr;                    /* NULL marks a poison/sentinel */
+    size_t len;
+    Chunk *chunk;
+    long no;                            /* 0-based line number */
+} Line;
+
+typedef struct LineReader {
+    int fd;
+    Chunk *cur;                         /* chunk lines are being cut from */
+    size_t pos;                         /* first byte not yet handed out */
+    size_t end;                         /* bytes of cur filled so far */
+    size_t scan;                        /* no newline in [pos, scan) */
+    long handed;                        /* lines handed out of cur */
+    long lines;                         /* lines handed out in total */
+    off_t map_size;                     /* file size if mapping, else 0 */
+    off_t map_off;                      /* file offset of cur->data[0] */
+    int eof;
+    int shared;
+    pthread_mutex_t mtx;                /* taken only if shared */
+} LineReader;
+
+static inline Chunk *chunk_new(size_t cap) {
+    Chunk *c = malloc(sizeof *c);
+    char *data = malloc(cap);
+    if (!c || !data) {
+        perror("malloc chunk");
+        exit(EXIT_FAILURE);
+    }
+    atomic_init(&c->refs, LR_CHUNK_BIAS);
+    c->data = data;
+    c->cap = cap;
+    c->mapped = 0;
+    return c;
+}
+
+static inline void chunk_free(Chunk *c) {
+    if (c->mapped) munmap(c->data, c->cap);
+    else           free(c->data);
+    free(c);
+}
+
+/* drops n references */
+static inline void chunk_put(Chunk *c, long n) {
+    if (atomic_fetch_sub_explicit(&c->refs, n, memory_order_acq_rel) == n) {
+        chunk_free(c);
+    }
+}
+
+static inline void line_release(Line *l) {
+    if (l->chunk) chunk_put(l->chunk, 1);
+    l->chunk = NULL;
+}
+
+static inline void line_write(const Line *l, FILE *out) {
+    fwrite(l->ptr, 1, l->len, out);
+}
+
+/* Parses a leading integer, like scanf("%d"). Returns 0 if there is none. */
+static inline int line_to_int(const Line *l, int *out) {
+    char tmp[32];
+    size_t n = l->len < sizeof tmp - 1 ? l->len : sizeof tmp - 1;
+    memcpy(tmp, l->ptr, n);
+    tmp[n] = '\0';
+    return sscanf(tmp, "%d", out) == 1;
+}
+
+static inline void lr_retire(LineReader *r) {
+    if (r->cur) chunk_put(r->cur, LR_CHUNK_BIAS - r->handed);
+    r->cur = NULL;
+    r->handed = 0;
+}
+
+/* Reads fd LR_CHUNK_SIZE bytes at a time. */
+static inline void lr_init_stream(LineReader *r, int fd) {
+    r->fd = fd;
+    r->cur = NULL;
+    r->pos = r->end = r->scan = 0;
+    r->handed = 0;
+    r->lines = 0;
+    r->map_size = r->map_off = 0;
+    r->eof = 0;
+    r->shared = 0;
+    pthread_mutex_init(&r->mtx, NULL);
+}
+
+/* Replaces cur with a mapping that starts at the page holding file offset
+ * at and covers at least need bytes past it. Returns 0 if mmap fails. */
+static inline int lr_map(LineReader *r, off_t at, size_t need) {
+    off_t base = at & ~(off_t)(sysconf(_SC_PAGESIZE) - 1);
+    size_t skip = (size_t)(at - base);
+    size_t len = LR_MAP_WINDOW;
+    while (len < 2 * (skip + need)) len *= 2;
+    if ((off_t)len > r->map_size - base) len = (size_t)(r->map_size - base);
+
+    void *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, r->fd, base);
+    if (map == MAP_FAILED) return 0;
+    madvise(map, len, MADV_SEQUENTIAL);
+
+    Chunk *c = malloc(sizeof *c);
+    if (!c) {
+        perror("malloc chunk");
+        exit(EXIT_FAILURE);
+    }
+    atomic_init(&c->refs, LR_CHUNK_BIAS);
+    c->data = map;
+    c->cap = len;
+    c->mapped = 1;
+
+    size_t scanned = r->cur ? r->scan - r->pos : 0;
+    lr_retire(r);
+    r->cur = c;
+    r->map_off = base;
+    r->pos = skip;
+    r->scan = skip + scanned;
+    r->end = len;
+    r->eof = base + (off_t)len == r->map_size;
+    return 1;
+}
+
+/* Maps fd if it is a regular file, from its current offset on; streams it
+ * otherwise. */
+static inline void lr_init(LineReader *r, int fd) {
+    struct stat st;
+    lr_init_stream(r, fd);
+
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) return;
+    off_t off = lseek(fd, 0, SEEK_CUR);
+    if (off < 0 || off >= st.st_size) return;
+
+    r->map_size = st.st_size;
+    if (!lr_map(r, off, 0)) r->map_size = 0;
+}
+
+/* Makes room after the unfinished tail of cur and reads (or maps) more. */
+static inline void lr_fill(LineReader *r) {
+    if (r->map_size) {
+        if (!lr_map(r, r->map_off + (off_t)r->pos, r->end - r->pos)) {
+            perror("mmap");
+            exit(EXIT_FAILURE);
+        }
+        return;
+    }
+
+    if (!r->cur || r->end == r->cur->cap) {
+        size_t tail = r->end - r->pos;
+        size_t cap = LR_CHUNK_SIZE;
+        while (cap < 2 * tail) cap *= 2;
+
+        if (r->cur && r->handed == 0) {
+            /* nothing points into cur yet: slide the tail down, or grow */
+            if (cap > r->cur->cap) {
+                char *data = realloc(r->cur->data, cap);
+                if (!data) {
+                    perror("realloc chunk");
+                    exit(EXIT_FAILURE);
+                }
+                r->cur->data = data;
+                r->cur->cap = cap;
+            }
+            memmove(r->cur->data, r->cur->data + r->pos, tail);
+        } else {
+            Chunk *c = chunk_new(cap);
+            if (tail) memcpy(c->data, r->cur->data + r->pos, tail);
+            lr_retire(r);
+            r->cur = c;
+        }
+        r->scan -= r->pos;
+        r->pos = 0;
+        r->end = tail;
+    }
+
+    for (;;) {
+        ssize_t n = read(r->fd, r->cur->data + r->end, r->cur->cap - r->end);
+        if (n > 0) {
+            r->end += (size_t)n;
+            return;
+        }
+        if (n == 0) {
+            r->eof = 1;
+            return;
+        }
+        if (errno != EINTR) {
+            perror("read");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+static inline int lr_cut(LineReader *r, Line *out) {
+    for (;;) {
+        if (r->cur) {
+            char *p = r->cur->data + r->pos;
+            size_t avail = r->end - r->pos;
+            char *nl = memchr(r->cur->data + r->scan, '\n', r->end - r->scan);
+
+            if (nl || (r->eof && avail)) {
+                out->ptr = p;
+                out->len = nl ? (size_t)(nl - p) + 1 : avail;
+                out->chunk = r->cur;
+                out->no = r->lines++;
+                r->pos += out->len;
+                r->scan = r->pos;
+                r->handed++;
+                return 1;
+            }
+            r->scan = r->end;
+        }
+        if (r->eof) return 0;
+        lr_fill(r);
+    }
+}
+
+/* Cuts the next line. Returns 0 at end of input. */
+static inline int lr_next(LineReader *r, Line *out) {
+    if (!r->shared) return lr_cut(r, out);
+
+    pthread_mutex_lock(&r->mtx);
+    int ok = lr_cut(r, out);
+    pthread_mutex_unlock(&r->mtx);
+    return ok;
+}
+
+/* Lines already handed out stay valid until released. */
+static inline void lr_close(LineReader *r) {
+    lr_retire(r);
+    pthread_mutex_destroy(&r->mtx);
+}
+
+#endif
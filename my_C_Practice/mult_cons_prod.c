@@ -1,13 +1,39 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
 #include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
 
-#define NUM_PROD 1        
+#include "batcher.h"
+#include "eventcount.h"
+#include "job_pool.h"
+#include "line_reader.h"
+#include "out_writer.h"
+
+#ifndef NUM_PROD
+#define NUM_PROD 1
+#endif
 #define NUM_CONS 7      
+#define CACHE_LINE 64
+#define SPIN_LIMIT 128         /* tries before parking; 0 on one CPU */
+
+/* 1 = lock-free MPMC queue, 0 = mutex/condvar BoundedBuffer */
+#ifndef USE_MPMC
+#define USE_MPMC 1
+#endif
+
+/* most lines a consumer takes per removeJobBatch() */
+#ifndef DRAIN_MAX
+#define DRAIN_MAX 32
+#endif
 
 typedef struct {
-    char **buf;
+    Line **buf;
     size_t cap;
     size_t count;
     size_t head; 
@@ -18,7 +44,7 @@ typedef struct {
 } BoundedBuffer;
 
 
-static void insertJob(BoundedBuffer *q, char *line) {
+static void insertJob(BoundedBuffer *q, Line *line) {
     pthread_mutex_lock(&q->mtx);
     while (q->count == q->cap) {
         pthread_cond_wait(&q->not_full, &q->mtx);
@@ -31,12 +57,12 @@ static void insertJob(BoundedBuffer *q, char *line) {
 }
 
 
-static char *removeJob(BoundedBuffer *q) {
+static Line *removeJob(BoundedBuffer *q) {
     pthread_mutex_lock(&q->mtx);
     while (q->count == 0) {
         pthread_cond_wait(&q->not_empty, &q->mtx);
     }
-    char *line = q->buf[q->head];
+    Line *line = q->buf[q->head];
     q->head = (q->head + 1) % q->cap;
     q->count--;
     pthread_cond_signal(&q->not_full);  
@@ -44,34 +70,281 @@ static char *removeJob(BoundedBuffer *q) {
     return line;
 }
 
-static void *producer(void *arg) {
-    BoundedBuffer *q = arg;
-    char buf[256];
+/* Inserts all n lines with one lock hold per run of free slots; a run of
+ * more than one line wakes every idle consumer instead of just one. */
+static void insertJobBatch(BoundedBuffer *q, Line **lines, size_t n) {
+    pthread_mutex_lock(&q->mtx);
+    while (n > 0) {
+        while (q->count == q->cap) {
+            pthread_cond_wait(&q->not_full, &q->mtx);
+        }
+        size_t k = 0;
+        while (k < n && q->count < q->cap) {
+            q->buf[q->tail] = lines[k++];
+            q->tail = (q->tail + 1) % q->cap;
+            q->count++;
+        }
+        lines += k;
+        n -= k;
+        if (k > 1) pthread_cond_broadcast(&q->not_empty);
+        else       pthread_cond_signal(&q->not_empty);
+    }
+    pthread_mutex_unlock(&q->mtx);
+}
 
-    while (fgets(buf, sizeof buf, stdin)) {
-        char *copy = strdup(buf);
-        if (!copy) {
-            perror("strdup");
-            exit(EXIT_FAILURE);
+/* Takes between 1 and max lines in one lock hold. A NULL (end of input)
+ * always ends the batch, so every consumer gets exactly one. */
+/* Returns 0 if deadline (when not NULL) passes with the queue still empty. */
+static size_t removeJobBatch(BoundedBuffer *q, Line **out, size_t max,
+                             const struct timespec *deadline) {
+    pthread_mutex_lock(&q->mtx);
+    while (q->count == 0) {
+        if (!deadline) {
+            pthread_cond_wait(&q->not_empty, &q->mtx);
+        } else if (pthread_cond_timedwait(&q->not_empty, &q->mtx, deadline) == ETIMEDOUT) {
+            pthread_mutex_unlock(&q->mtx);
+            return 0;
         }
-        insertJob(q, copy);
     }
-    return NULL;
+    size_t k = 0;
+    while (k < max && q->count > 0) {
+        Line *line = q->buf[q->head];
+        q->head = (q->head + 1) % q->cap;
+        q->count--;
+        out[k++] = line;
+        if (line == NULL) break;
+    }
+    if (k > 1) pthread_cond_broadcast(&q->not_full);
+    else       pthread_cond_signal(&q->not_full);
+    pthread_mutex_unlock(&q->mtx);
+    return k;
 }
 
-static void *consumer(void *arg) {
-    BoundedBuffer *q = arg;
+/* Bounded MPMC queue after Dmitry Vyukov: every cell carries a sequence
+ * number that says whose turn it is. A producer owns cell pos when
+ * seq == pos, a consumer when seq == pos + 1, and each side claims a
+ * position with a single CAS on its own counter, so producers and consumers
+ * never touch the same cache line unless the queue is nearly empty/full. */
+typedef struct {
+    _Atomic size_t seq;
+    Line *line;
+} Cell;
+
+typedef struct {
+    Cell *cells;
+    size_t mask;
+    int spin;
+    _Alignas(CACHE_LINE) _Atomic size_t enq_pos;
+    _Alignas(CACHE_LINE) _Atomic size_t deq_pos;
+    _Alignas(CACHE_LINE) EventCount not_empty;
+    _Alignas(CACHE_LINE) EventCount not_full;
+} MpmcQueue;
+
+static inline void mpmc_init(MpmcQueue *q, size_t cap) {
+    size_t n = 2;
+    while (n < cap) n <<= 1;
+
+    q->cells = malloc(n * sizeof *q->cells);
+    if (!q->cells) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < n; i++) {
+        atomic_init(&q->cells[i].seq, i);
+    }
+    q->mask = n - 1;
+    q->spin = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SPIN_LIMIT : 0;
+    atomic_init(&q->enq_pos, 0);
+    atomic_init(&q->deq_pos, 0);
+    ec_init(&q->not_empty);
+    ec_init(&q->not_full);
+}
+
+static inline void mpmc_destroy(MpmcQueue *q) {
+    free(q->cells);
+}
+
+static int mpmc_try_push(MpmcQueue *q, Line *line) {
+    size_t pos = atomic_load_explicit(&q->enq_pos, memory_order_relaxed);
     for (;;) {
-        char *line = removeJob(q);
-        if (line == NULL) {
+        Cell *c = &q->cells[pos & q->mask];
+        size_t seq = atomic_load_explicit(&c->seq, memory_order_acquire);
+        intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+        if (dif == 0) {
+            if (atomic_compare_exchange_weak_explicit(&q->enq_pos, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                c->line = line;
+                atomic_store_explicit(&c->seq, pos + 1, memory_order_release);
+                return 1;
+            }
+        } else if (dif < 0) {
+            return 0;
+        } else {
+            pos = atomic_load_explicit(&q->enq_pos, memory_order_relaxed);
+        }
+    }
+}
+
+static int mpmc_try_pop(MpmcQueue *q, Line **out) {
+    size_t pos = atomic_load_explicit(&q->deq_pos, memory_order_relaxed);
+    for (;;) {
+        Cell *c = &q->cells[pos & q->mask];
+        size_t seq = atomic_load_explicit(&c->seq, memory_order_acquire);
+        intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (dif == 0) {
+            if (atomic_compare_exchange_weak_explicit(&q->deq_pos, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                *out = c->line;
+                atomic_store_explicit(&c->seq, pos + q->mask + 1, memory_order_release);
+                return 1;
+            }
+        } else if (dif < 0) {
+            return 0;
+        } else {
+            pos = atomic_load_explicit(&q->deq_pos, memory_order_relaxed);
+        }
+    }
+}
+
+static void mpmc_push_wait(MpmcQueue *q, Line *line) {
+    for (int i = 0; !mpmc_try_push(q, line); i++) {
+        if (i < q->spin) {
+            cpu_relax();
+            continue;
+        }
+        uint32_t key = ec_prepare(&q->not_full);
+        if (mpmc_try_push(q, line)) {
+            ec_cancel(&q->not_full, key);
+            break;
+        }
+        ec_wait(&q->not_full, key, NULL);
+    }
+}
+
+/* Returns 0 if deadline (when not NULL) passes with the queue still empty. */
+static int mpmc_pop_wait(MpmcQueue *q, Line **line, const struct timespec *deadline) {
+    for (int i = 0; !mpmc_try_pop(q, line); i++) {
+        if (i < q->spin) {
+            cpu_relax();
+            continue;
+        }
+        uint32_t key = ec_prepare(&q->not_empty);
+        if (mpmc_try_pop(q, line)) {
+            ec_cancel(&q->not_empty, key);
             break;
         }
-        fputs(line, stdout);
-        free(line);
+        if (!ec_wait(&q->not_empty, key, deadline)) return mpmc_try_pop(q, line);
+    }
+    return 1;
+}
+
+static inline void mpmc_insertJob(MpmcQueue *q, Line *line) {
+    mpmc_push_wait(q, line);
+    ec_notify(&q->not_empty, 1);
+}
+
+static inline Line *mpmc_removeJob(MpmcQueue *q) {
+    Line *line;
+    mpmc_pop_wait(q, &line, NULL);
+    ec_notify(&q->not_full, 1);
+    return line;
+}
+
+/* Batched forms pay for one eventcount notify per run of lines instead of
+ * one per line. A batch goes in as runs of whatever fits, each announced
+ * before the producer waits for room for the next: lines pushed but not
+ * yet announced could leave every consumer asleep with nobody to make
+ * that room. */
+static inline void mpmc_insertJobBatch(MpmcQueue *q, Line **lines, size_t n) {
+    size_t i = 0;
+    while (i < n) {
+        size_t k = i;
+        while (k < n && mpmc_try_push(q, lines[k])) k++;
+        if (k == i) mpmc_push_wait(q, lines[k++]);
+        ec_notify(&q->not_empty, (uint32_t)(k - i));
+        i = k;
     }
+}
+
+static inline size_t mpmc_removeJobBatch(MpmcQueue *q, Line **out, size_t max,
+                                         const struct timespec *deadline) {
+    size_t k = 0;
+    if (!mpmc_pop_wait(q, &out[k++], deadline)) return 0;
+    while (k < max && out[k - 1] != NULL && mpmc_try_pop(q, &out[k])) {
+        k++;
+    }
+    ec_notify(&q->not_full, (uint32_t)k);
+    return k;
+}
+
+#if USE_MPMC
+typedef MpmcQueue Pipe;
+#define pipe_init    mpmc_init
+#define pipe_destroy mpmc_destroy
+#define pipe_put     mpmc_insertJob
+#define pipe_get     mpmc_removeJob
+#define pipe_put_batch mpmc_insertJobBatch
+#define pipe_get_batch mpmc_removeJobBatch
+#else
+typedef BoundedBuffer Pipe;
+#define pipe_init    q_init
+#define pipe_destroy q_destroy
+#define pipe_put     insertJob
+#define pipe_get     removeJob
+#define pipe_put_batch insertJobBatch
+#define pipe_get_batch removeJobBatch
+#endif
+
+static LineReader input;               /* stdin, shared by the producers */
+static Reorder reorder;                 /* ORDERED_OUTPUT only */
+
+static void flush_lines(void *q, void **items, size_t n) {
+    pipe_put_batch(q, (Line **)items, n);
+}
+
+static void *producer(void *arg) {
+    Pipe *q = arg;
+    Line l;
+    Batcher b;
+
+    batcher_init(&b, q, flush_lines);
+    while (lr_next(&input, &l)) {
+        Line *line = pool_alloc(sizeof *line);
+        *line = l;
+        batcher_add(&b, line);
+    }
+    batcher_close(&b);
     return NULL;
 }
 
+static void *consumer(void *arg) {
+    Pipe *q = arg;
+    Line *lines[DRAIN_MAX];
+    Writer out;
+
+    out_init(&out, STDOUT_FILENO);
+    for (;;) {
+        struct timespec linger;
+        size_t n = pipe_get_batch(q, lines, DRAIN_MAX,
+                                  out_deadline(&out, &linger) ? &linger : NULL);
+        if (n == 0) {
+            out_flush(&out);            /* idle for OUT_LINGER_US */
+            continue;
+        }
+        for (size_t i = 0; i < n; i++) {
+            if (lines[i] == NULL) {
+                out_close(&out);
+                pool_flush();
+                return NULL;
+            }
+            if (ORDERED_OUTPUT) reorder_line(&reorder, lines[i]->no, lines[i]);
+            else                out_line(&out, lines[i]);
+            pool_free(lines[i]);
+        }
+        pool_flush();
+    }
+}
+
 static void q_init(BoundedBuffer *q, size_t cap) {
     q->buf = malloc(cap * sizeof *q->buf);
     if (!q->buf) {
@@ -84,7 +357,7 @@ static void q_init(BoundedBuffer *q, size_t cap) {
     q->tail = 0;
     pthread_mutex_init(&q->mtx, NULL);
     pthread_cond_init(&q->not_full, NULL);
-    pthread_cond_init(&q->not_empty, NULL);
+    out_cond_init(&q->not_empty);
 }
 
 static void q_destroy(BoundedBuffer *q) {
@@ -94,9 +367,203 @@ static void q_destroy(BoundedBuffer *q) {
     free(q->buf);
 }
 
+#ifdef BENCH
+/* gcc -O2 -DBENCH -pthread mult_cons_prod.c -o mcp_bench */
+
+#define BENCH_LINES 500000
+#define BENCH_WORK  64          /* per-line spin standing in for fputs */
+
+static Line bench_line = {"bench line\n", 11, NULL, 0};
+static _Atomic long bench_consumed;
+
+static double bench_now_s(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static void bench_work(void) {
+    for (volatile int w = 0; w < BENCH_WORK; w++) {
+    }
+}
+
+static void *bench_mutex_prod(void *arg) {
+    for (long i = 0; i < BENCH_LINES / NUM_PROD; i++) insertJob(arg, &bench_line);
+    return NULL;
+}
+
+static void *bench_mutex_cons(void *arg) {
+    long n = 0;
+    while (removeJob(arg)) {
+        bench_work();
+        n++;
+    }
+    atomic_fetch_add(&bench_consumed, n);
+    return NULL;
+}
+
+static void *bench_mpmc_prod(void *arg) {
+    for (long i = 0; i < BENCH_LINES / NUM_PROD; i++) mpmc_insertJob(arg, &bench_line);
+    return NULL;
+}
+
+static void *bench_mpmc_cons(void *arg) {
+    long n = 0;
+    while (mpmc_removeJob(arg)) {
+        bench_work();
+        n++;
+    }
+    atomic_fetch_add(&bench_consumed, n);
+    return NULL;
+}
+
+static double bench_run(void *q, int ncons,
+                        void *(*prod_fn)(void *), void *(*cons_fn)(void *),
+                        void (*put)(void *, Line *)) {
+    pthread_t prod[NUM_PROD], cons[64];
+
+    atomic_store(&bench_consumed, 0);
+    double t0 = bench_now_s();
+    for (int k = 0; k < NUM_PROD; k++) pthread_create(&prod[k], NULL, prod_fn, q);
+    for (int i = 0; i < ncons; i++) pthread_create(&cons[i], NULL, cons_fn, q);
+    for (int k = 0; k < NUM_PROD; k++) pthread_join(prod[k], NULL);
+    for (int i = 0; i < ncons; i++) put(q, NULL);
+    for (int i = 0; i < ncons; i++) pthread_join(cons[i], NULL);
+    double dt = bench_now_s() - t0;
+
+    long expect = (long)(BENCH_LINES / NUM_PROD) * NUM_PROD;
+    if (atomic_load(&bench_consumed) != expect) {
+        fprintf(stderr, "lost lines: %ld of %ld\n", atomic_load(&bench_consumed), expect);
+        exit(EXIT_FAILURE);
+    }
+    return expect / dt;
+}
+
+static void bench_put_mutex(void *q, Line *line) { insertJob(q, line); }
+static void bench_put_mpmc(void *q, Line *line) { mpmc_insertJob(q, line); }
+
+/* Consumer scaling, 1..64 consumers, for both backends. */
 int main(void) {
-    BoundedBuffer q;
-    q_init(&q, 1024);
+    (void)producer;
+    (void)consumer;
+    (void)insertJobBatch;
+    (void)removeJobBatch;
+
+    printf("%6s %16s %16s\n", "cons", "mutex lines/s", "mpmc lines/s");
+    for (int ncons = 1; ncons <= 64; ncons *= 2) {
+        BoundedBuffer bq;
+        q_init(&bq, 1024);
+        double mutex_rate = bench_run(&bq, ncons, bench_mutex_prod, bench_mutex_cons, bench_put_mutex);
+        q_destroy(&bq);
+
+        MpmcQueue mq;
+        mpmc_init(&mq, 1024);
+        double mpmc_rate = bench_run(&mq, ncons, bench_mpmc_prod, bench_mpmc_cons, bench_put_mpmc);
+        mpmc_destroy(&mq);
+
+        printf("%6d %16.0f %16.0f\n", ncons, mutex_rate, mpmc_rate);
+    }
+    return 0;
+}
+
+#elif defined(BENCH_SUITE)
+/* Both queues in bench/bench.c's suite; the queued element is the job's
+ * Line, as with real input. */
+#include "bench/bench.h"
+
+static void *suite_mutex_create(int arg, size_t cap) {
+    BoundedBuffer *q = malloc(sizeof *q);
+    (void)arg;
+    if (!q) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    q_init(q, cap);
+    return q;
+}
+
+static void suite_mutex_put(void *q, BenchJob *job) {
+    Line *line = (Line *)job->item;
+    *line = job->line;
+    insertJob(q, line);
+}
+
+static BenchJob *suite_mutex_get(void *q, int self) {
+    Line *line = removeJob(q);
+    (void)self;
+    return line ? bench_job_of(line) : NULL;
+}
+
+static void suite_mutex_stop(void *q, int ncons) {
+    for (int i = 0; i < ncons; i++) insertJob(q, NULL);
+}
+
+static void suite_mutex_destroy(void *q) {
+    q_destroy(q);
+    free(q);
+}
+
+static void *suite_mpmc_create(int arg, size_t cap) {
+    MpmcQueue *q = malloc(sizeof *q);
+    (void)arg;
+    if (!q) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    mpmc_init(q, cap);
+    return q;
+}
+
+static void suite_mpmc_put(void *q, BenchJob *job) {
+    Line *line = (Line *)job->item;
+    *line = job->line;
+    mpmc_insertJob(q, line);
+}
+
+static BenchJob *suite_mpmc_get(void *q, int self) {
+    Line *line = mpmc_removeJob(q);
+    (void)self;
+    return line ? bench_job_of(line) : NULL;
+}
+
+static void suite_mpmc_stop(void *q, int ncons) {
+    for (int i = 0; i < ncons; i++) mpmc_insertJob(q, NULL);
+}
+
+static void suite_mpmc_destroy(void *q) {
+    mpmc_destroy(q);
+    free(q);
+}
+
+void bench_register_mult_cons_prod(void) {
+    static const BenchCase cases[] = {
+        { "mult_cons_prod", "mutex", "-", 0, BENCH_MAX_THREADS, BENCH_MAX_THREADS, 1, sizeof(Line),
+          suite_mutex_create, suite_mutex_put, suite_mutex_get, suite_mutex_stop, suite_mutex_destroy },
+        { "mult_cons_prod", "mpmc", "-", 0, BENCH_MAX_THREADS, BENCH_MAX_THREADS, 1, sizeof(Line),
+          suite_mpmc_create, suite_mpmc_put, suite_mpmc_get, suite_mpmc_stop, suite_mpmc_destroy },
+    };
+    (void)producer;
+    (void)consumer;
+    (void)insertJobBatch;
+    (void)removeJobBatch;
+    for (size_t i = 0; i < sizeof cases / sizeof cases[0]; i++) bench_add(&cases[i]);
+}
+
+#else
+
+int main(void) {
+    Pipe q;
+    /* the pipeline uses only some of the mutex backend, USE_MPMC none */
+    (void)insertJob;
+    (void)removeJob;
+    (void)insertJobBatch;
+    (void)removeJobBatch;
+    (void)q_init;
+    (void)q_destroy;
+    pipe_init(&q, 1024);
+    lr_init(&input, STDIN_FILENO);
+    input.shared = NUM_PROD > 1;
+    if (ORDERED_OUTPUT) reorder_init(&reorder, STDOUT_FILENO, 0);
 
     pthread_t prod_threads[NUM_PROD];
     pthread_t cons_threads[NUM_CONS];
@@ -122,13 +589,17 @@ int main(void) {
     }
 
     for (int i = 0; i < NUM_CONS; ++i) {
-        insertJob(&q, NULL);
+        pipe_put(&q, NULL);
     }
 
     for (int i = 0; i < NUM_CONS; ++i) {
         pthread_join(cons_threads[i], NULL);
     }
 
-    q_destroy(&q);
+    if (ORDERED_OUTPUT) reorder_close(&reorder);
+    lr_close(&input);
+    pipe_destroy(&q);
     return 0;
 }
+
+#endif
@@ -0,0 +1,322 @@
+#ifndef OUT_WRITER_H
+#define OUT_WRITER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "job_pool.h"
+#include "line_reader.h"
+
+/* Buffered output for consumers, so they stop meeting on stdout's lock.
+ *
+ * Each consumer owns a Writer: a list of iovecs flushed with one writev()
+ * when it fills, at exit, or when the consumer has sat idle until its
+ * oldest buffered byte is OUT_LINGER_US old (out_deadline() gives the time
+ * to wait on the queue until). Flushing every time a consumer ran dry would
+ * mean a writev() per handful of lines whenever consumers outpace the
+ * producer, which on few cores is most of the time. Input
+ * lines are not copied: the iovec points into the line's chunk and the
+ * writer keeps the chunk reference until the bytes are written, batching
+ * the releases per chunk. Formatted text goes into the writer's own
+ * OUT_TEXT buffer, and contiguous pieces share one iovec. Flushes take
+ * one process-wide lock, since a writev() to a pipe larger than PIPE_BUF
+ * may otherwise interleave with another consumer's mid-line; that is one
+ * lock per few hundred lines instead of stdio's one per line.
+ *
+ * With ORDERED_OUTPUT a Reorder restores input order instead: consumers
+ * park finished output under its sequence number (job id or line number)
+ * and whoever fills the gap at the head emits the contiguous run through
+ * the Reorder's single writer. The window starts at REORDER_WINDOW entries
+ * and doubles rather than blocking a consumer, since under SJF, PRIORITY
+ * or RR the job everyone is waiting for may still be sitting in the ready
+ * set. */
+
+#ifndef ORDERED_OUTPUT
+#define ORDERED_OUTPUT 0
+#endif
+
+#ifndef REORDER_WINDOW
+#define REORDER_WINDOW 4096
+#endif
+
+#ifndef OUT_LINGER_US
+#define OUT_LINGER_US 1000
+#endif
+
+#define OUT_IOV  256
+#define OUT_TEXT (64 * 1024)
+
+typedef struct ChunkRun {
+    Chunk *chunk;
+    long n;                             /* references held on chunk */
+} ChunkRun;
+
+typedef struct Writer {
+    int fd;
+    int niov;
+    int nruns;
+    size_t text_used;
+    struct timespec first;              /* CLOCK_MONOTONIC when iov[0] was queued */
+    struct iovec iov[OUT_IOV];
+    ChunkRun runs[OUT_IOV];
+    char text[OUT_TEXT];
+} Writer;
+
+static inline void out_init(Writer *w, int fd) {
+    w->fd = fd;
+    w->niov = 0;
+    w->nruns = 0;
+    w->text_used = 0;
+}
+
+static pthread_mutex_t out_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+/* caller holds out_mtx */
+static inline void out_writev(int fd, struct iovec *iov, int n) {
+    while (n > 0) {
+        ssize_t k = writev(fd, iov, n);
+        if (k < 0) {
+            if (errno == EINTR) continue;
+            perror("writev");
+            exit(EXIT_FAILURE);
+        }
+        while (n > 0 && (size_t)k >= iov->iov_len) {
+            k -= (ssize_t)iov->iov_len;
+            iov++;
+            n--;
+        }
+        if (n > 0) {
+            iov->iov_base = (char *)iov->iov_base + k;
+            iov->iov_len -= (size_t)k;
+        }
+    }
+}
+
+static inline void out_flush(Writer *w) {
+    if (w->niov) {
+        pthread_mutex_lock(&out_mtx);
+        out_writev(w->fd, w->iov, w->niov);
+        pthread_mutex_unlock(&out_mtx);
+    }
+    for (int i = 0; i < w->nruns; i++) {
+        chunk_put(w->runs[i].chunk, w->runs[i].n);
+    }
+    w->niov = 0;
+    w->nruns = 0;
+    w->text_used = 0;
+}
+
+/* Flushes unless there is an iovec, a chunk run and text bytes to spare. */
+static inline void out_room(Writer *w, size_t text) {
+    if (w->niov == OUT_IOV || w->nruns == OUT_IOV || text > OUT_TEXT - w->text_used) {
+        out_flush(w);
+    }
+}
+
+/* Returns 0 if nothing is buffered; otherwise sets *ts to the absolute
+ * CLOCK_MONOTONIC time by which the buffer should be flushed, so a step of
+ * the wall clock neither holds it back nor flushes it early. A condvar
+ * waited on until then must be set up with out_cond_init(). */
+static inline int out_deadline(const Writer *w, struct timespec *ts) {
+    if (!w->niov) return 0;
+    *ts = w->first;
+    ts->tv_nsec += OUT_LINGER_US * 1000L;
+    ts->tv_sec  += ts->tv_nsec / 1000000000L;
+    ts->tv_nsec %= 1000000000L;
+    return 1;
+}
+
+/* a condvar whose pthread_cond_timedwait() takes out_deadline() times */
+static inline void out_cond_init(pthread_cond_t *cv) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cv, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+/* caller made room */
+static inline void out_iov(Writer *w, const char *p, size_t len) {
+    if (!w->niov) {
+        clock_gettime(CLOCK_MONOTONIC, &w->first);
+    } else {
+        struct iovec *last = &w->iov[w->niov - 1];
+        if ((const char *)last->iov_base + last->iov_len == p) {
+            last->iov_len += len;
+            return;
+        }
+    }
+    w->iov[w->niov].iov_base = (char *)p;
+    w->iov[w->niov].iov_len = len;
+    w->niov++;
+}
+
+/* Queues l without copying it; the writer takes over l's chunk reference. */
+static inline void out_line(Writer *w, Line *l) {
+    out_room(w, 0);
+    out_iov(w, l->ptr, l->len);
+
+    if (l->chunk) {
+        if (w->nruns && w->runs[w->nruns - 1].chunk == l->chunk) {
+            w->runs[w->nruns - 1].n++;
+        } else {
+            w->runs[w->nruns].chunk = l->chunk;
+            w->runs[w->nruns].n = 1;
+            w->nruns++;
+        }
+        l->chunk = NULL;
+    }
+}
+
+static inline void out_text(Writer *w, const char *s, size_t len) {
+    out_room(w, len);
+    if (len > OUT_TEXT) {
+        struct iovec big = { (char *)s, len };
+        pthread_mutex_lock(&out_mtx);
+        out_writev(w->fd, &big, 1);
+        pthread_mutex_unlock(&out_mtx);
+        return;
+    }
+    memcpy(w->text + w->text_used, s, len);
+    out_iov(w, w->text + w->text_used, len);
+    w->text_used += len;
+}
+
+static inline void out_vprintf(Writer *w, const char *fmt, va_list ap) {
+    va_list again;
+    va_copy(again, ap);
+    out_room(w, 128);
+    size_t room = OUT_TEXT - w->text_used;
+    int n = vsnprintf(w->text + w->text_used, room, fmt, ap);
+
+    if (n >= 0 && (size_t)n < room) {
+        out_iov(w, w->text + w->text_used, (size_t)n);
+        w->text_used += (size_t)n;
+    } else if (n >= 0) {
+        char *tmp = malloc((size_t)n + 1);
+        if (!tmp) {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+        vsnprintf(tmp, (size_t)n + 1, fmt, again);
+        out_text(w, tmp, (size_t)n);
+        free(tmp);
+    }
+    va_end(again);
+}
+
+static inline void out_printf(Writer *w, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    out_vprintf(w, fmt, ap);
+    va_end(ap);
+}
+
+static inline void out_close(Writer *w) {
+    out_flush(w);
+}
+
+typedef struct ReorderItem {
+    Line line;                          /* output still in its chunk */
+    char *text;                         /* or pool-allocated text */
+    size_t text_len;
+    int full;
+} ReorderItem;
+
+typedef struct Reorder {
+    ReorderItem *slot;
+    size_t mask;
+    long next;                          /* first sequence not yet written */
+    long held;                          /* items parked in slot[] */
+    pthread_mutex_t mtx;
+    Writer out;
+} Reorder;
+
+static inline void reorder_init(Reorder *ro, int fd, long first) {
+    size_t cap = 1;
+    while (cap < REORDER_WINDOW) cap <<= 1;
+
+    ro->slot = calloc(cap, sizeof *ro->slot);
+    if (!ro->slot) {
+        perror("calloc reorder");
+        exit(EXIT_FAILURE);
+    }
+    ro->mask = cap - 1;
+    ro->next = first;
+    ro->held = 0;
+    pthread_mutex_init(&ro->mtx, NULL);
+    out_init(&ro->out, fd);
+}
+
+/* caller holds ro->mtx */
+static inline void reorder_grow(Reorder *ro) {
+    size_t cap = ro->mask + 1;
+    ReorderItem *slot = calloc(2 * cap, sizeof *slot);
+    if (!slot) {
+        perror("calloc reorder");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < cap; i++) {
+        long seq = ro->next + (long)i;
+        slot[(size_t)seq & (2 * cap - 1)] = ro->slot[(size_t)seq & ro->mask];
+    }
+    free(ro->slot);
+    ro->slot = slot;
+    ro->mask = 2 * cap - 1;
+}
+
+/* caller holds ro->mtx */
+static inline void reorder_put(Reorder *ro, long seq, ReorderItem *item) {
+    while ((size_t)(seq - ro->next) > ro->mask) reorder_grow(ro);
+    ro->slot[(size_t)seq & ro->mask] = *item;
+    ro->held++;
+
+    ReorderItem *it;
+    while ((it = &ro->slot[(size_t)ro->next & ro->mask])->full) {
+        if (it->text) {
+            out_text(&ro->out, it->text, it->text_len);
+            pool_free(it->text);
+        } else {
+            out_line(&ro->out, &it->line);
+        }
+        it->full = 0;
+        ro->next++;
+        ro->held--;
+    }
+    /* caught up: nothing left to wait for, so don't sit on the output */
+    if (ro->held == 0) out_flush(&ro->out);
+}
+
+/* Parks line seq; the reorder takes over its chunk reference. */
+static inline void reorder_line(Reorder *ro, long seq, Line *l) {
+    ReorderItem item = { *l, NULL, 0, 1 };
+    l->chunk = NULL;
+
+    pthread_mutex_lock(&ro->mtx);
+    reorder_put(ro, seq, &item);
+    pthread_mutex_unlock(&ro->mtx);
+}
+
+/* Parks pool-allocated text as entry seq; the reorder frees it. */
+static inline void reorder_text(Reorder *ro, long seq, char *text, size_t len) {
+    ReorderItem item = { { NULL, 0, NULL, 0 }, text, len, 1 };
+
+    pthread_mutex_lock(&ro->mtx);
+    reorder_put(ro, seq, &item);
+    pthread_mutex_unlock(&ro->mtx);
+}
+
+static inline void reorder_close(Reorder *ro) {
+    out_close(&ro->out);
+    pthread_mutex_destroy(&ro->mtx);
+    free(ro->slot);
+}
+
+#endif
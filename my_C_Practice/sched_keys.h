@@ -0,0 +1,108 @@
+#ifndef SCHED_KEYS_H
+#define SCHED_KEYS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__AVX2__) || defined(__SSE4_2__)
+#include <immintrin.h>
+#endif
+
+/* Packed scheduling keys, kept in an array of their own next to the Job
+ * pointers they order, so picking the next job reads contiguous keys and
+ * never follows a pointer into a Job.
+ *
+ * A key is the primary ordering value (SJF's cost, EDF's deadline) above
+ * an arrival sequence number, so one unsigned compare orders by that and
+ * then by arrival, and no two keys in a set are equal (until the sequence
+ * wraps, after 2^32 arrivals, which can only reorder ties). The top bit is always 0,
+ * so the keys also compare correctly as signed, which is all SSE4.2 and
+ * AVX2 offer for 64-bit lanes.
+ *
+ * key_argmin() over longer spans is vectorized when built with -mavx2
+ * (4 keys per compare) or -msse4.2 (2 keys), and scalar otherwise:
+ *   gcc -O2 -mavx2 -pthread scheduling_policies.c -o sp -lm */
+
+#define KEY_SEQ_BITS   32
+#define KEY_MAJOR_MAX  ((1ull << (63 - KEY_SEQ_BITS)) - 1)
+
+/* major is clamped to 0..KEY_MAJOR_MAX (INT_MAX), so anything past it
+ * ties there and comes out in arrival order */
+static inline uint64_t key_pack(long major, uint64_t seq) {
+    uint64_t m = major < 0 ? 0 : (uint64_t)major;
+    if (m > KEY_MAJOR_MAX) m = KEY_MAJOR_MAX;
+    return m << KEY_SEQ_BITS | (seq & ((1ull << KEY_SEQ_BITS) - 1));
+}
+
+/* index of the smallest of exactly 4 keys (a full heap node); the first
+ * one on a tie. Two compares and a third between the winners, all cmovs:
+ * for 4 keys this beats the lane shuffles a vector reduction needs. */
+static inline size_t key_argmin4(const uint64_t *k) {
+    size_t lo = k[1] < k[0], hi = 2 + (k[3] < k[2]);
+    return k[hi] < k[lo] ? hi : lo;
+}
+
+/* index of the smallest of k[0..n), n >= 1; the first one on a tie */
+static inline size_t key_argmin(const uint64_t *k, size_t n) {
+    if (n == 4) return key_argmin4(k);
+
+    size_t best = 0, c = 1;
+#if defined(__AVX2__)
+    if (n >= 16) {
+        /* a running minimum and its index per lane, in two independent
+         * sets so one compare need not wait for the last, then the lanes */
+        __m256i mv0 = _mm256_loadu_si256((const __m256i *)k);
+        __m256i mv1 = _mm256_loadu_si256((const __m256i *)(k + 4));
+        __m256i mi0 = _mm256_setr_epi64x(0, 1, 2, 3);
+        __m256i mi1 = _mm256_setr_epi64x(4, 5, 6, 7);
+        __m256i idx0 = mi0, idx1 = mi1, step = _mm256_set1_epi64x(8);
+        for (c = 8; c + 8 <= n; c += 8) {
+            __m256i v0 = _mm256_loadu_si256((const __m256i *)(k + c));
+            __m256i v1 = _mm256_loadu_si256((const __m256i *)(k + c + 4));
+            idx0 = _mm256_add_epi64(idx0, step);
+            idx1 = _mm256_add_epi64(idx1, step);
+            __m256i lt0 = _mm256_cmpgt_epi64(mv0, v0);
+            __m256i lt1 = _mm256_cmpgt_epi64(mv1, v1);
+            mv0 = _mm256_blendv_epi8(mv0, v0, lt0);
+            mv1 = _mm256_blendv_epi8(mv1, v1, lt1);
+            mi0 = _mm256_blendv_epi8(mi0, idx0, lt0);
+            mi1 = _mm256_blendv_epi8(mi1, idx1, lt1);
+        }
+        uint64_t lv[8], li[8];
+        _mm256_storeu_si256((__m256i *)lv, mv0);
+        _mm256_storeu_si256((__m256i *)(lv + 4), mv1);
+        _mm256_storeu_si256((__m256i *)li, mi0);
+        _mm256_storeu_si256((__m256i *)(li + 4), mi1);
+        best = li[0];
+        for (int l = 1; l < 8; l++) {
+            if (lv[l] < k[best] || (lv[l] == k[best] && li[l] < best)) best = li[l];
+        }
+    }
+#elif defined(__SSE4_2__)
+    if (n >= 4) {
+        __m128i mv = _mm_loadu_si128((const __m128i *)k);
+        __m128i mi = _mm_set_epi64x(1, 0);
+        __m128i idx = mi, step = _mm_set1_epi64x(2);
+        for (c = 2; c + 2 <= n; c += 2) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(k + c));
+            idx = _mm_add_epi64(idx, step);
+            __m128i lt = _mm_cmpgt_epi64(mv, v);
+            mv = _mm_blendv_epi8(mv, v, lt);
+            mi = _mm_blendv_epi8(mi, idx, lt);
+        }
+        uint64_t v0 = (uint64_t)_mm_cvtsi128_si64(mv), v1 = (uint64_t)_mm_extract_epi64(mv, 1);
+        uint64_t i0 = (uint64_t)_mm_cvtsi128_si64(mi), i1 = (uint64_t)_mm_extract_epi64(mi, 1);
+        best = (v1 < v0 || (v1 == v0 && i1 < i0)) ? i1 : i0;
+    }
+#endif
+    uint64_t min = k[best];
+    for (; c < n; c++) {
+        if (k[c] < min) {
+            min = k[c];
+            best = c;
+        }
+    }
+    return best;
+}
+
+#endif
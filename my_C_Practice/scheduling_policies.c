@@ -3,26 +3,96 @@
 #include <pthread.h>
 #include <string.h>
 #include <time.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdatomic.h>
 
-#define NUM_PROD 1        
+#include "batcher.h"
+#include "job_pool.h"
+#include "line_reader.h"
+#include "out_writer.h"
+#include "job_trace.h"
+#include "workload.h"
+#include "lat_hist.h"
+#include "sched_keys.h"
+
+#ifndef NUM_PROD
+#define NUM_PROD 1
+#endif
 #define NUM_CONS 7      
+#define HEAP_ARITY 4
+#define MAX_PRIO   100      /* producer draws priority from 1..MAX_PRIO */
+#define CACHE_LINE 64
+
+/* 1 = per-consumer run queues with stealing, 0 = one global ReadySet */
+#ifndef WORK_STEALING
+#define WORK_STEALING 1
+#endif
+
+/* Most jobs the producer queues on one consumer. A job can be overtaken by
+ * at most NUM_CONS * LOCAL_DEPTH later arrivals, so this is the knob that
+ * trades global ordering against contention. */
+#ifndef LOCAL_DEPTH
+#define LOCAL_DEPTH 16
+#endif
+
+/* most jobs a consumer takes per removeJobBatch_as() */
+#ifndef DRAIN_MAX
+#define DRAIN_MAX 8
+#endif
+
+/* PRIORITY aging: a job gains one priority level per PRIO_AGING_US it
+ * has waited since arrival_time, so under steady high-priority load a
+ * low-priority job still runs within (MAX_PRIO - 1) * PRIO_AGING_US of
+ * the later arrivals; 0 = no aging, strict priority */
+#ifndef PRIO_AGING_US
+#define PRIO_AGING_US 1000
+#endif
+
+/* 1 = main() runs a copy of the producer and consumer loops built for the
+ * chosen policy, 0 = the generic loops, which look at the policy on every
+ * put and take */
+#ifndef SPECIALIZE
+#define SPECIALIZE 1
+#endif
+
+/* The queue code below takes the policy as an argument and is forced inline
+ * into each per-policy loop (POLICY_LOOPS), where the policy is a constant:
+ * the branches on it fold away and only that policy's structure is left.
+ * The plain-named versions pass rs->policy and are the runtime fallback. */
+#define POLICY_INLINE static inline __attribute__((always_inline))
 
-static int next_job_id = 0;
 
 enum policy { FCFS, SJF, PRIORITY};
 
+static const char *policy_names[] = { "FCFS", "SJF", "PRIORITY" };
+
 typedef struct job {
     int id;
-    char *payload;
+    Line payload;                       /* view into the input, ptr NULL = poison */
     int priority;
     int cost;
     struct timespec arrival_time;
+    JobTimes times;                     /* LAT_STATS */
+    struct job *next;
 } Job;
 
+typedef struct JobList {
+    Job *head;
+    Job *tail;
+} JobList;
+
 typedef struct ReadySet {
-    Job **jobs;
+    Job **jobs;                         /* SJF, aged PRIORITY: a 4-ary min-heap */
+    uint64_t *keys;                     /* keys[i] orders jobs[i] */
+    uint64_t seq;                       /* arrivals to the heap so far */
     size_t cap;
     size_t count; 
+    JobList fifo;                       /* FCFS */
+    JobList prio[MAX_PRIO + 1];         /* PRIORITY, bucket 0 holds poison */
+    uint64_t prio_bitmap[(MAX_PRIO + 64) / 64];
+    long aging_us;                      /* PRIORITY, 0 = the buckets, no aging */
+    uint64_t epoch_us;                  /* PRIORITY, ages count from here */
     pthread_mutex_t mtx;
     pthread_cond_t not_full;
     pthread_cond_t not_empty;
@@ -30,122 +100,969 @@ typedef struct ReadySet {
 }ReadySet;
 
 
+/* SJF keeps rs->jobs as a 4-ary min-heap: shortest cost first, earlier
+ * arrival on ties. Four children per node keeps a sift-down inside one or
+ * two cache lines and halves the tree depth of a binary heap. The heap
+ * orders rs->keys (sched_keys.h), major over arrival sequence, and moves
+ * rs->jobs along with them, so a sift compares keys in place instead of
+ * loading each child's Job; a full node's four children are one
+ * key_argmin4(). */
+static void heap_push(ReadySet *rs, Job *job, long major) {
+    uint64_t key = key_pack(major, rs->seq++);
+    size_t i = rs->count++;
+    while (i > 0) {
+        size_t parent = (i - 1) / HEAP_ARITY;
+        if (key > rs->keys[parent]) break;
+        rs->jobs[i] = rs->jobs[parent];
+        rs->keys[i] = rs->keys[parent];
+        i = parent;
+    }
+    rs->jobs[i] = job;
+    rs->keys[i] = key;
+}
+
+static Job *heap_pop(ReadySet *rs) {
+    Job *top = rs->jobs[0];
+    size_t n = --rs->count;
+    Job *last = rs->jobs[n];
+    uint64_t last_key = rs->keys[n];
+    size_t i = 0;
+
+    for (;;) {
+        size_t first = i * HEAP_ARITY + 1;
+        if (first >= n) break;
+        size_t end = first + HEAP_ARITY < n ? first + HEAP_ARITY : n;
+        size_t best = first + key_argmin(&rs->keys[first], end - first);
+        if (rs->keys[best] > last_key) break;
+        rs->jobs[i] = rs->jobs[best];
+        rs->keys[i] = rs->keys[best];
+        i = best;
+    }
+    if (n > 0) {
+        rs->jobs[i] = last;
+        rs->keys[i] = last_key;
+    }
+    return top;
+}
+
+static void list_push(JobList *l, Job *job) {
+    job->next = NULL;
+    if (l->tail) l->tail->next = job;
+    else         l->head = job;
+    l->tail = job;
+}
+
+static Job *list_pop(JobList *l) {
+    Job *job = l->head;
+    l->head = job->next;
+    if (!l->head) l->tail = NULL;
+    return job;
+}
+
+/* PRIORITY keeps one FIFO list per priority level plus a bitmap of the
+ * non-empty ones, like the Linux O(1) scheduler: pick the highest set bit,
+ * pop the head of that list. Equal priorities come out in arrival order. */
+static void prio_push(ReadySet *rs, Job *job) {
+    int p = job->priority;
+    list_push(&rs->prio[p], job);
+    rs->prio_bitmap[p / 64] |= 1ULL << (p % 64);
+    rs->count++;
+}
+
+static Job *prio_pop(ReadySet *rs) {
+    int w = (int)(sizeof rs->prio_bitmap / sizeof rs->prio_bitmap[0]) - 1;
+    while (rs->prio_bitmap[w] == 0) w--;
+    int p = w * 64 + 63 - __builtin_clzll(rs->prio_bitmap[w]);
+
+    Job *job = list_pop(&rs->prio[p]);
+    if (!rs->prio[p].head) rs->prio_bitmap[w] &= ~(1ULL << (p % 64));
+    rs->count--;
+    return job;
+}
+
+/* With aging, PRIORITY runs the job with the highest priority + waited /
+ * aging_us. Every queued job ages at the same rate, so that order never
+ * changes while they wait: it is the order of arrival / aging_us -
+ * priority, fixed when the job is queued, and the SJF heap keeps it. */
+static long prio_aged_key(const ReadySet *rs, const Job *job) {
+    uint64_t us = lat_ns(&job->arrival_time) / 1000;
+    long age = us > rs->epoch_us ? (long)((us - rs->epoch_us) / (uint64_t)rs->aging_us) : 0;
+    return age + (MAX_PRIO - job->priority);
+}
+
+/* rs_put/rs_take do the policy-specific bookkeeping; callers hold rs->mtx
+ * and have already checked for room / for a job. */
+POLICY_INLINE void rs_put_as(ReadySet *rs, Job *job, enum policy policy) {
+    if (policy == SJF) {
+        heap_push(rs, job, job->cost);
+    } else if (policy == PRIORITY) {
+        if (rs->aging_us) heap_push(rs, job, prio_aged_key(rs, job));
+        else              prio_push(rs, job);
+    } else {
+        list_push(&rs->fifo, job);
+        rs->count++;
+    }
+}
+
+POLICY_INLINE Job *rs_take_as(ReadySet *rs, enum policy policy) {
+    Job *job;
+
+    if (policy == FCFS) {
+        job = list_pop(&rs->fifo);
+        rs->count--;
+    }
+
+    else if (policy == SJF) job = heap_pop(rs);
+
+    else if (policy == PRIORITY) job = rs->aging_us ? heap_pop(rs) : prio_pop(rs);
+
+    else {
+        pthread_mutex_unlock(&rs->mtx);
+        fprintf(stderr, "Unknown Policy");
+        exit(EXIT_FAILURE);
+    }
+    return job;
+}
+
+static void rs_put(ReadySet *rs, Job *job) {
+    rs_put_as(rs, job, rs->policy);
+}
+
+static Job *rs_take(ReadySet *rs) {
+    return rs_take_as(rs, rs->policy);
+}
+
 static void insertJob(ReadySet *rs, Job* job) {
     pthread_mutex_lock(&rs->mtx);
     while (rs->count == rs->cap) {
         pthread_cond_wait(&rs->not_full, &rs->mtx);
     }
-    rs->jobs[rs->count] = job;
-    rs->count++;
+    rs_put(rs, job);
     pthread_cond_signal(&rs->not_empty);  
     pthread_mutex_unlock(&rs->mtx);
 }
 
 
-static Job *removeJob(ReadySet *rs) {
+static inline Job *removeJob(ReadySet *rs) {
     pthread_mutex_lock(&rs->mtx);
     while (rs->count == 0) {
         pthread_cond_wait(&rs->not_empty, &rs->mtx);
     }
     
-    size_t best = 0;
+    Job *job = rs_take(rs);
 
-    if(rs->policy == FCFS) best = 0;
+    pthread_cond_signal(&rs->not_full);
+    pthread_mutex_unlock(&rs->mtx);
+    return job;
+}
 
-    else if(rs->policy == SJF){
-        best = 0;
-        for(size_t i = 1; i < rs->count; i++){
-            if(rs->jobs[i]->cost < rs->jobs[best]->cost){
-                best = i;
-            }
+/* Inserts all n jobs with one lock hold per run of free slots; a run of
+ * more than one job wakes every idle consumer instead of just one. */
+POLICY_INLINE void insertJobBatch_as(ReadySet *rs, Job **jobs, size_t n,
+                                    enum policy policy) {
+    pthread_mutex_lock(&rs->mtx);
+    while (n > 0) {
+        while (rs->count == rs->cap) {
+            pthread_cond_wait(&rs->not_full, &rs->mtx);
+        }
+        size_t k = 0;
+        while (k < n && rs->count < rs->cap) {
+            rs_put_as(rs, jobs[k++], policy);
         }
+        jobs += k;
+        n -= k;
+        if (k > 1) pthread_cond_broadcast(&rs->not_empty);
+        else       pthread_cond_signal(&rs->not_empty);
     }
+    pthread_mutex_unlock(&rs->mtx);
+}
 
-    else if(rs->policy == PRIORITY){
-        best = 0;
-        for(size_t i = 1; i < rs->count; i++){
-            if(rs->jobs[i]->priority > rs->jobs[best]->priority){
-                best = i;
-            }
+/* Takes the best 1..max jobs in one lock hold, in policy order. A poison
+ * job always ends the batch, so every consumer gets exactly one. Returns 0
+ * if deadline (when not NULL) passes with the set still empty. */
+POLICY_INLINE size_t removeJobBatch_as(ReadySet *rs, Job **out, size_t max,
+                                      const struct timespec *deadline,
+                                      enum policy policy) {
+    pthread_mutex_lock(&rs->mtx);
+    while (rs->count == 0) {
+        if (!deadline) {
+            pthread_cond_wait(&rs->not_empty, &rs->mtx);
+        } else if (pthread_cond_timedwait(&rs->not_empty, &rs->mtx, deadline) == ETIMEDOUT) {
+            pthread_mutex_unlock(&rs->mtx);
+            return 0;
+        }
+    }
+    size_t k = 0;
+    while (k < max && rs->count > 0) {
+        Job *job = rs_take_as(rs, policy);
+        out[k++] = job;
+        if (job->payload.ptr == NULL) break;
     }
+    if (k > 1) pthread_cond_broadcast(&rs->not_full);
+    else       pthread_cond_signal(&rs->not_full);
+    pthread_mutex_unlock(&rs->mtx);
+    return k;
 }
-    else {
-        pthread_mutex_unlock(&rs->mtx);
-        fprintf(stderr, "Unknown Policy");
+
+static void insertJobBatch(ReadySet *rs, Job **jobs, size_t n) {
+    insertJobBatch_as(rs, jobs, n, rs->policy);
+}
+
+
+static void rs_init(ReadySet *rs, size_t cap) {
+    rs->jobs = malloc(cap * sizeof *rs->jobs);
+    rs->keys = malloc(cap * sizeof *rs->keys);
+    if (!rs->jobs || !rs->keys) {
+        perror("malloc");
         exit(EXIT_FAILURE);
     }
+    rs->cap = cap;
+    rs->count = 0;
+    rs->seq = 0;
+    rs->policy = FCFS;
+    rs->aging_us = PRIO_AGING_US;
+    rs->epoch_us = lat_now() / 1000;
+    memset(&rs->fifo, 0, sizeof rs->fifo);
+    memset(rs->prio, 0, sizeof rs->prio);
+    memset(rs->prio_bitmap, 0, sizeof rs->prio_bitmap);
+    pthread_mutex_init(&rs->mtx, NULL); 
+    pthread_cond_init(&rs->not_full, NULL);
+    out_cond_init(&rs->not_empty);
+}
 
-    Job *job = rs->jobs[best];
-    rs->jobs[best] = rs->jobs[rs->count-1];
-    rs->count--;
+static void rs_destroy(ReadySet *rs) {
+    pthread_cond_destroy(&rs->not_full);
+    pthread_cond_destroy(&rs->not_empty);
+    pthread_mutex_destroy(&rs->mtx);
+    free(rs->jobs);
+    free(rs->keys);
+}
 
-    pthread_cond_signal(&rs->not_full);
-    pthread_mutex_unlock(&rs->mtx);
+/* Work stealing: every consumer owns a run queue, the producer spreads
+ * jobs over them and a consumer that runs dry steals from its neighbours,
+ * so the common path never touches a lock another consumer wants.
+ *
+ * FCFS queues are Chase-Lev deques used as FIFOs: pushes go to the bottom
+ * (serialised by push_mtx, since the producer is not the owner) and the
+ * owner and thieves alike take from the top with one CAS. SJF and PRIORITY
+ * queues are small private ReadySets, so each consumer still runs its own
+ * best job first. */
+typedef struct Deque {
+    _Alignas(CACHE_LINE) _Atomic size_t top;
+    _Alignas(CACHE_LINE) _Atomic size_t bottom;
+    _Atomic(Job *) *buf;
+    size_t mask;
+} Deque;
+
+typedef struct Scheduler Scheduler;
+
+typedef struct RunQueue {
+    Deque dq;
+    ReadySet local;
+    pthread_mutex_t push_mtx;
+    _Alignas(CACHE_LINE) _Atomic int load;   /* >= jobs queued here */
+    Scheduler *sched;
+    int self;
+} RunQueue;
+
+struct Scheduler {
+    RunQueue rq[NUM_CONS];
+    enum policy policy;
+    _Atomic unsigned next;          /* producers' rotating start point */
+    _Atomic int idle;               /* consumers parked on work */
+    _Atomic int prod_waiting;       /* producers parked on space */
+    _Atomic int stop;
+    pthread_mutex_t idle_mtx;
+    pthread_cond_t work;
+    pthread_cond_t space;
+};
+
+static void dq_init(Deque *dq, size_t cap) {
+    size_t n = 1;
+    while (n < cap) n <<= 1;
+    dq->buf = malloc(n * sizeof *dq->buf);
+    if (!dq->buf) {
+        perror("malloc deque");
+        exit(EXIT_FAILURE);
+    }
+    dq->mask = n - 1;
+    atomic_init(&dq->top, 0);
+    atomic_init(&dq->bottom, 0);
+}
+
+static void dq_push(Deque *dq, Job *job) {
+    size_t b = atomic_load_explicit(&dq->bottom, memory_order_relaxed);
+    atomic_store_explicit(&dq->buf[b & dq->mask], job, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&dq->bottom, b + 1, memory_order_relaxed);
+}
+
+static Job *dq_steal(Deque *dq) {
+    for (;;) {
+        size_t t = atomic_load_explicit(&dq->top, memory_order_acquire);
+        atomic_thread_fence(memory_order_seq_cst);
+        size_t b = atomic_load_explicit(&dq->bottom, memory_order_acquire);
+        if (t >= b) return NULL;
+
+        Job *job = atomic_load_explicit(&dq->buf[t & dq->mask], memory_order_relaxed);
+        if (atomic_compare_exchange_strong_explicit(&dq->top, &t, t + 1,
+                memory_order_seq_cst, memory_order_relaxed)) {
+            return job;
+        }
+    }
+}
+
+POLICY_INLINE void rq_push_batch(RunQueue *rq, Job **jobs, size_t n, enum policy policy) {
+    atomic_fetch_add(&rq->load, (int)n);
+    if (policy == FCFS) {
+        pthread_mutex_lock(&rq->push_mtx);
+        for (size_t i = 0; i < n; i++) dq_push(&rq->dq, jobs[i]);
+        pthread_mutex_unlock(&rq->push_mtx);
+    } else {
+        pthread_mutex_lock(&rq->local.mtx);
+        for (size_t i = 0; i < n; i++) rs_put_as(&rq->local, jobs[i], policy);
+        pthread_mutex_unlock(&rq->local.mtx);
+    }
+}
+
+POLICY_INLINE Job *rq_take(RunQueue *rq, enum policy policy) {
+    Job *job = NULL;
+    if (policy == FCFS) {
+        job = dq_steal(&rq->dq);
+    } else {
+        pthread_mutex_lock(&rq->local.mtx);
+        if (rq->local.count) job = rs_take_as(&rq->local, policy);
+        pthread_mutex_unlock(&rq->local.mtx);
+    }
+    if (job) atomic_fetch_sub(&rq->load, 1);
     return job;
 }
 
+/* Producers pick and fill a queue without a lock between them, so each can
+ * top it up to LOCAL_DEPTH from the same stale load: NUM_PROD + 1 times
+ * LOCAL_DEPTH is room for all of them at once. */
+static void ws_init(Scheduler *s, enum policy policy) {
+    s->policy = policy;
+    atomic_init(&s->next, 0);
+    atomic_init(&s->idle, 0);
+    atomic_init(&s->prod_waiting, 0);
+    atomic_init(&s->stop, 0);
+    pthread_mutex_init(&s->idle_mtx, NULL);
+    out_cond_init(&s->work);
+    pthread_cond_init(&s->space, NULL);
 
-static void *producer(void *arg) {
-    ReadySet *rs = arg;
-    char buf[256];
+    for (int i = 0; i < NUM_CONS; i++) {
+        RunQueue *rq = &s->rq[i];
+        dq_init(&rq->dq, (NUM_PROD + 1) * LOCAL_DEPTH);
+        rs_init(&rq->local, (NUM_PROD + 1) * LOCAL_DEPTH);
+        rq->local.policy = policy;
+        pthread_mutex_init(&rq->push_mtx, NULL);
+        atomic_init(&rq->load, 0);
+        rq->sched = s;
+        rq->self = i;
+    }
+}
 
-    while (fgets(buf, sizeof buf, stdin)) {
-        char *copy = strdup(buf);
-        if (!copy) {
-            perror("strdup");
-            exit(EXIT_FAILURE);
+static void ws_destroy(Scheduler *s) {
+    for (int i = 0; i < NUM_CONS; i++) {
+        free(s->rq[i].dq.buf);
+        rs_destroy(&s->rq[i].local);
+        pthread_mutex_destroy(&s->rq[i].push_mtx);
+    }
+    pthread_cond_destroy(&s->space);
+    pthread_cond_destroy(&s->work);
+    pthread_mutex_destroy(&s->idle_mtx);
+}
+
+/* Least-loaded queue, scanning from a rotating start so ties spread
+ * round-robin; -1 if every queue is already LOCAL_DEPTH deep. */
+static int ws_pick(Scheduler *s) {
+    unsigned start = atomic_fetch_add_explicit(&s->next, 1, memory_order_relaxed);
+    int best = -1, best_load = LOCAL_DEPTH;
+    for (int k = 0; k < NUM_CONS; k++) {
+        int i = (int)((start + k) % NUM_CONS);
+        int load = atomic_load(&s->rq[i].load);
+        if (load < best_load) {
+            best = i;
+            best_load = load;
+            if (load == 0) break;
         }
-        Job *job = malloc(sizeof *job);
-        if (!job) {
-         perror("malloc job");
-         exit(EXIT_FAILURE);
+    }
+    return best;
+}
+
+static int ws_pick_wait(Scheduler *s) {
+    int i = ws_pick(s);
+    if (i < 0) {
+        pthread_mutex_lock(&s->idle_mtx);
+        atomic_fetch_add(&s->prod_waiting, 1);
+        while ((i = ws_pick(s)) < 0) {
+            pthread_cond_wait(&s->space, &s->idle_mtx);
+        }
+        atomic_fetch_sub(&s->prod_waiting, 1);
+        pthread_mutex_unlock(&s->idle_mtx);
+    }
+    return i;
+}
+
+static void ws_wake(Scheduler *s, size_t n) {
+    if (atomic_load(&s->idle)) {
+        pthread_mutex_lock(&s->idle_mtx);
+        if (n > 1) pthread_cond_broadcast(&s->work);
+        else       pthread_cond_signal(&s->work);
+        pthread_mutex_unlock(&s->idle_mtx);
+    }
+}
+
+/* Fills the least-loaded queue up to LOCAL_DEPTH under one lock, then the
+ * next one, and wakes idle consumers once per queue touched. */
+POLICY_INLINE void ws_submit_batch_as(Scheduler *s, Job **jobs, size_t n, enum policy policy) {
+    while (n > 0) {
+        int i = ws_pick_wait(s);
+        int room = LOCAL_DEPTH - atomic_load(&s->rq[i].load);
+        size_t k = room < 1 ? 1 : (size_t)room;
+        if (k > n) k = n;
+
+        rq_push_batch(&s->rq[i], jobs, k, policy);
+        jobs += k;
+        n -= k;
+        ws_wake(s, k);
+    }
+}
+
+/* Own queue first, then the neighbours in ring order. */
+POLICY_INLINE Job *ws_find(RunQueue *rq, enum policy policy) {
+    Scheduler *s = rq->sched;
+    for (int k = 0; k < NUM_CONS; k++) {
+        Job *job = rq_take(&s->rq[(rq->self + k) % NUM_CONS], policy);
+        if (job) return job;
+    }
+    return NULL;
+}
+
+/* A consumer took a job: one producer waiting for room can retry. */
+static void ws_took(Scheduler *s) {
+    if (atomic_load(&s->prod_waiting)) {
+        pthread_mutex_lock(&s->idle_mtx);
+        pthread_cond_signal(&s->space);
+        pthread_mutex_unlock(&s->idle_mtx);
+    }
+}
+
+/* Blocks until there is a job anywhere, or returns NULL once ws_stop() has
+ * been called and every queue is empty, or once deadline (when not NULL)
+ * passes. idle is raised before the last scan and read by ws_submit()
+ * after its push, so a job queued while we fall asleep always comes with a
+ * signal. */
+POLICY_INLINE Job *ws_next_as(RunQueue *rq, const struct timespec *deadline,
+                              enum policy policy) {
+    Scheduler *s = rq->sched;
+    Job *job = ws_find(rq, policy);
+
+    if (!job) {
+        pthread_mutex_lock(&s->idle_mtx);
+        atomic_fetch_add(&s->idle, 1);
+        while (!(job = ws_find(rq, policy)) && !atomic_load(&s->stop)) {
+            if (!deadline) {
+                pthread_cond_wait(&s->work, &s->idle_mtx);
+            } else if (pthread_cond_timedwait(&s->work, &s->idle_mtx, deadline) == ETIMEDOUT) {
+                job = ws_find(rq, policy);
+                break;
             }
+        }
+        atomic_fetch_sub(&s->idle, 1);
+        pthread_mutex_unlock(&s->idle_mtx);
+    }
 
-        job->id = next_job_id++;
-        job->payload = copy;
-        job->cost = rand() % 10 + 1;
-        job->priority = rand() % 100 + 1;
+    if (job) ws_took(s);
+    return job;
+}
+
+static void ws_submit_batch(Scheduler *s, Job **jobs, size_t n) {
+    ws_submit_batch_as(s, jobs, n, s->policy);
+}
+
+static inline Job *ws_next(RunQueue *rq, const struct timespec *deadline) {
+    return ws_next_as(rq, deadline, rq->sched->policy);
+}
+
+static void ws_stop(Scheduler *s) {
+    pthread_mutex_lock(&s->idle_mtx);
+    atomic_store(&s->stop, 1);
+    pthread_cond_broadcast(&s->work);
+    pthread_mutex_unlock(&s->idle_mtx);
+}
+
+POLICY_INLINE void flush_jobs_as(void *sched, void **items, size_t n, enum policy policy) {
+    if (WORK_STEALING) ws_submit_batch_as(sched, (Job **)items, n, policy);
+    else               insertJobBatch_as(sched, (Job **)items, n, policy);
+}
+
+static void flush_jobs(void *sched, void **items, size_t n) {
+    if (WORK_STEALING) ws_submit_batch(sched, (Job **)items, n);
+    else               insertJobBatch(sched, (Job **)items, n);
+}
+
+static LineReader input;               /* stdin, shared by the producers */
+static Trace trace;
+static Trace *replay;                   /* &trace if argv[1] named one */
+static JobSource source;
+static Reorder reorder;                 /* ORDERED_OUTPUT only */
+
+/* arg is the Scheduler with WORK_STEALING, the global ReadySet without;
+ * flush is what the batches are handed to */
+POLICY_INLINE void *producer_as(void *arg, void (*flush)(void *, void **, size_t)) {
+    JobDraw d;
+    WlPacer pacer;
+    Batcher b;
+
+    batcher_init(&b, arg, flush);
+    wl_pacer_init(&pacer);
+    while (src_next(&source, &pacer, &d)) {
+        Job *job = pool_alloc(sizeof *job);
+        job->id = (int)d.id;
+        job->payload = d.payload;
+        job->cost = d.cost;             /* below the poison's INT_MAX */
+        job->priority = d.priority;
         clock_gettime(CLOCK_MONOTONIC, &job->arrival_time);
-        insertJob(rs, job);
+        lat_arrive(&job->times, lat_ns(&job->arrival_time));
+        batcher_add(&b, job);
+    }
+    batcher_close(&b);
+    return NULL;
+}
+
+static void *producer(void *arg) {
+    return producer_as(arg, flush_jobs);
+}
+
+/* A job runs in one go: its slice is writing it out. */
+static void finish_job(Job *job, Writer *out) {
+    lat_dispatch(&job->times, 0);
+    if (ORDERED_OUTPUT) reorder_line(&reorder, job->id, &job->payload);
+    else                out_line(out, &job->payload);
+    lat_ran(&job->times, 0);
+    lat_done(&job->times, 0);
+    pool_free(job);
+}
+
+POLICY_INLINE void *consumer_as(ReadySet *rs, enum policy policy) {
+    Job *jobs[DRAIN_MAX];
+    Writer out;
+
+    out_init(&out, STDOUT_FILENO);
+    for (;;) {
+        struct timespec linger;
+        size_t n = removeJobBatch_as(rs, jobs, DRAIN_MAX,
+                                     out_deadline(&out, &linger) ? &linger : NULL, policy);
+        if (n == 0) {
+            out_flush(&out);            /* idle for OUT_LINGER_US */
+            continue;
+        }
+        for (size_t i = 0; i < n; i++) {
+            if (jobs[i]->payload.ptr == NULL) {
+             pool_free(jobs[i]);
+             out_close(&out);
+             pool_flush();
+             return NULL;
+                }
+
+            finish_job(jobs[i], &out);
+        }
+        pool_flush();
     }
+}
+
+POLICY_INLINE void *ws_consumer_as(RunQueue *rq, enum policy policy) {
+    Writer out;
+    Job *job;
+
+    out_init(&out, STDOUT_FILENO);
+    for (;;) {
+        struct timespec linger;
+        if (!(job = ws_next_as(rq, out_deadline(&out, &linger) ? &linger : NULL, policy))) {
+            out_flush(&out);            /* idle for OUT_LINGER_US, or stopped */
+            pool_flush();
+            if (!(job = ws_next_as(rq, NULL, policy))) break;
+        }
+        finish_job(job, &out);
+    }
+    out_close(&out);
+    pool_flush();
     return NULL;
 }
 
 static void *consumer(void *arg) {
     ReadySet *rs = arg;
+    return consumer_as(rs, rs->policy);
+}
 
-    for (;;) {
-        Job *job = removeJob(rs);   
-        if (job->payload == NULL) {
-         free(job);
-         break;
+static void *ws_consumer(void *arg) {
+    RunQueue *rq = arg;
+    return ws_consumer_as(rq, rq->sched->policy);
+}
+
+#ifdef BENCH
+/* gcc -O2 -DBENCH -pthread scheduling_policies.c -o sched_bench -lm */
+
+static double bench_now_ns(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+/* Steady-state SJF dequeue latency: keep the set full, pop one job and push
+ * a fresh one, and time only the pops. The linear scan that removeJob() used
+ * before the heap is timed alongside for comparison. */
+static void bench_sjf(void) {
+    const int iters = 200000;
+
+    printf("%10s %14s %14s %14s\n", "cap", "heap ns/pop", "ptr scan ns", "key scan ns");
+    for (size_t cap = 1024; cap <= (1u << 20); cap *= 4) {
+        ReadySet rs;
+        rs_init(&rs, cap);
+        rs.policy = SJF;
+
+        Job *pool = malloc(cap * sizeof *pool);
+        if (!pool) {
+            perror("malloc pool");
+            exit(EXIT_FAILURE);
+        }
+        for (size_t i = 0; i < cap; i++) {
+            pool[i].cost = rand() % 10 + 1;
+            insertJob(&rs, &pool[i]);
+        }
+
+        double heap_ns = 0;
+        for (int it = 0; it < iters; it++) {
+            double t0 = bench_now_ns();
+            Job *j = removeJob(&rs);
+            heap_ns += bench_now_ns() - t0;
+            j->cost = rand() % 10 + 1;
+            insertJob(&rs, j);
+        }
+
+        /* a full scan for the minimum: through the Job pointers, and over
+         * the key array with key_argmin() */
+        int scans = (int)((1u << 24) / cap);
+        double t0 = bench_now_ns();
+        volatile size_t sink = 0;
+        for (int it = 0; it < scans; it++) {
+            size_t best = 0;
+            for (size_t i = 1; i < rs.count; i++) {
+                if (rs.jobs[i]->cost < rs.jobs[best]->cost) best = i;
             }
+            sink += best;
+        }
+        double scan_ns = (bench_now_ns() - t0) / scans;
+
+        t0 = bench_now_ns();
+        for (int it = 0; it < scans; it++) sink += key_argmin(rs.keys, rs.count);
+        double key_ns = (bench_now_ns() - t0) / scans;
+
+        printf("%10zu %14.1f %14.1f %14.1f\n", cap, heap_ns / iters, scan_ns, key_ns);
+        rs_destroy(&rs);
+        free(pool);
+    }
+}
+
+/* PRIORITY aging: one consumer in virtual time, fed Poisson arrivals of
+ * exponential 10us jobs, 90% at MAX_PRIO and 10% at priority 1. Waits are
+ * reported per class for strict priority (aging 0) and for several aging
+ * rates; window is how far (MAX_PRIO - 1) levels of aging reach, which is
+ * how much later a high-priority arrival can still go ahead of a low one. */
+#define BENCH_AGING_JOBS 2000000
+#define BENCH_AGING_SVC  10.0               /* us per job, mean */
+
+static LatHist bench_aging_wait[2];         /* [0] high, [1] low, in ns */
+
+static double bench_exp(double mean) {
+    return -mean * log((rand() + 1.0) / ((double)RAND_MAX + 2.0));
+}
+
+static void bench_aging_run(double load, long aging_us) {
+    ReadySet rs;
+    rs_init(&rs, BENCH_AGING_JOBS);
+    rs.policy = PRIORITY;
+    rs.aging_us = aging_us;
+    rs.epoch_us = 0;
+    lat_hist_reset(&bench_aging_wait[0]);
+    lat_hist_reset(&bench_aging_wait[1]);
+
+    double now = 0, next = 0;
+    long made = 0, served = 0;
+    while (served < BENCH_AGING_JOBS) {
+        if (made < BENCH_AGING_JOBS && (rs.count == 0 || next <= now)) {
+            if (rs.count == 0 && next > now) now = next;
+            Job *job = pool_alloc(sizeof *job);
+            uint64_t us = (uint64_t)next;
+            job->arrival_time.tv_sec = (time_t)(us / 1000000);
+            job->arrival_time.tv_nsec = (long)(us % 1000000) * 1000;
+            job->priority = rand() % 10 ? MAX_PRIO : 1;
+            job->cost = 0;
+            rs_put_as(&rs, job, PRIORITY);
+            made++;
+            next += bench_exp(BENCH_AGING_SVC / load);
+            continue;
+        }
+        Job *job = rs_take_as(&rs, PRIORITY);
+        uint64_t wait_us = (uint64_t)now - lat_ns(&job->arrival_time) / 1000;
+        lat_hist_add(&bench_aging_wait[job->priority != MAX_PRIO], wait_us * 1000);
+        now += bench_exp(BENCH_AGING_SVC);
+        served++;
+        pool_free(job);
+    }
+
+    for (int c = 0; c < 2; c++) {
+        const LatHist *h = &bench_aging_wait[c];
+        printf("%6.2f %10ld %10ld %6s %10.0f %10.0f %10.0f %10.0f\n", load, aging_us,
+               aging_us * (MAX_PRIO - 1), c ? "low" : "high", lat_hist_pct(h, 0.50) / 1e3,
+               lat_hist_pct(h, 0.99) / 1e3, lat_hist_pct(h, 0.999) / 1e3,
+               atomic_load(&h->max) / 1e3);
+    }
+    rs_destroy(&rs);
+}
+
+static void bench_aging(void) {
+    static const long rates[] = { 0, 10000, 1000, 100 };
+    static const double loads[] = { 0.95, 1.05 };
+
+    printf("\n%6s %10s %10s %6s %10s %10s %10s %10s\n", "load", "aging us", "window us",
+           "class", "wait p50", "p99", "p99.9", "max");
+    for (size_t l = 0; l < sizeof loads / sizeof *loads; l++) {
+        for (size_t r = 0; r < sizeof rates / sizeof *rates; r++) {
+            bench_aging_run(loads[l], rates[r]);
+        }
+    }
+}
 
-        fputs(job->payload, stdout);
-        free(job->payload);
-        free(job);
+/* Job generation rate: what the producers did before (rand() under its
+ * lock and a shared id counter) against workload.h, by cost shape, with
+ * BENCH_GEN_THREADS producers making BENCH_GEN_JOBS jobs between them. */
+#define BENCH_GEN_JOBS    20000000
+#define BENCH_GEN_THREADS 4
+
+static _Atomic long bench_gen_id;
+static WlIds bench_gen_ids;
+static int bench_gen_dist;
+static _Atomic long bench_gen_sink;
+
+static void *bench_gen_rand(void *arg) {
+    long sum = 0;
+    (void)arg;
+    while (atomic_fetch_add(&bench_gen_id, 1) < BENCH_GEN_JOBS) {
+        sum += rand() % 10 + 1;
+        sum += rand() % 100 + 1;
     }
+    atomic_fetch_add(&bench_gen_sink, sum);
+    return NULL;
+}
 
+static void *bench_gen_wl(void *arg) {
+    long id, sum = 0;
+    (void)arg;
+    while (wl_claim(&bench_gen_ids, &id)) {
+        sum += wl_draw_int(bench_gen_dist, 1, 10, INT_MAX - 1);
+        sum += wl_draw_int(WL_UNIFORM, 1, MAX_PRIO, MAX_PRIO);
+    }
+    atomic_fetch_add(&bench_gen_sink, sum);
     return NULL;
 }
 
-static void rs_init(ReadySet *rs, size_t cap) {
-    rs->jobs = malloc(cap * sizeof *rs->jobs);
-    if (!rs->jobs) {
+static double bench_gen_run(void *(*fn)(void *)) {
+    pthread_t t[BENCH_GEN_THREADS];
+    double t0 = bench_now_ns();
+    for (int i = 0; i < BENCH_GEN_THREADS; i++) {
+        if (pthread_create(&t[i], NULL, fn, NULL) != 0) {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int i = 0; i < BENCH_GEN_THREADS; i++) pthread_join(t[i], NULL);
+    return BENCH_GEN_JOBS / ((bench_now_ns() - t0) / 1e9);
+}
+
+static void bench_generate(void) {
+    static const char *names[] = { "uniform", "exponential", "pareto", "bimodal" };
+
+    atomic_store(&bench_gen_id, 0);
+    double base = bench_gen_run(bench_gen_rand);
+    printf("\n%-20s %12s\n", "generator", "Mjobs/s");
+    printf("%-20s %12.1f\n", "rand()", base / 1e6);
+    for (int d = WL_UNIFORM; d <= WL_BIMODAL; d++) {
+        bench_gen_dist = d;
+        wl_ids_init(&bench_gen_ids, BENCH_GEN_JOBS);
+        double rate = bench_gen_run(bench_gen_wl);
+        char label[32];
+        snprintf(label, sizeof label, "xoshiro %s", names[d]);
+        printf("%-20s %12.1f (%.1fx)\n", label, rate / 1e6, rate / base);
+    }
+}
+
+int main(void) {
+    /* the real pipeline is not run here */
+    (void)producer;
+    (void)consumer;
+    (void)trace;
+    (void)replay;
+    (void)input;
+    (void)ws_consumer;
+    (void)ws_init;
+    (void)ws_stop;
+    (void)ws_destroy;
+    (void)policy_names;
+    srand(1);
+    bench_sjf();
+    bench_aging();
+    bench_generate();
+    return 0;
+}
+
+#elif defined(BENCH_SUITE)
+/* The global ReadySet and the work-stealing Scheduler, under each policy,
+ * in bench/bench.c's suite. The queued element is a Job. */
+#include "bench/bench.h"
+
+typedef struct SuiteGlobal {
+    ReadySet rs;
+    Job poison[BENCH_MAX_THREADS];
+} SuiteGlobal;
+
+static Job *suite_job(BenchJob *b) {
+    Job *job = (Job *)b->item;
+    job->id = (int)b->id;
+    job->payload = b->line;
+    job->cost = b->cost;
+    job->priority = b->priority;
+    clock_gettime(CLOCK_MONOTONIC, &job->arrival_time);
+    return job;
+}
+
+static void *suite_global_create(int policy, size_t cap) {
+    SuiteGlobal *g = malloc(sizeof *g);
+    if (!g) {
         perror("malloc");
         exit(EXIT_FAILURE);
     }
-    rs->cap = cap;
-    rs->count = 0;
-    pthread_mutex_init(&rs->mtx, NULL); 
+    rs_init(&g->rs, cap);
+    g->rs.policy = policy;
+    return g;
 }
 
-static void rs_destroy(ReadySet *rs) {
-    pthread_mutex_destroy(&rs->mtx);
-    free(rs->jobs);
+static void suite_global_put(void *q, BenchJob *b) {
+    insertJob(&((SuiteGlobal *)q)->rs, suite_job(b));
 }
 
-int main(void) {
+static BenchJob *suite_global_get(void *q, int self) {
+    Job *job = removeJob(&((SuiteGlobal *)q)->rs);
+    (void)self;
+    return job->payload.ptr ? bench_job_of(job) : NULL;
+}
+
+/* poison as in main(): after every real job, so SJF drains first */
+static void suite_global_stop(void *q, int ncons) {
+    SuiteGlobal *g = q;
+    for (int i = 0; i < ncons; i++) {
+        Job *poison = &g->poison[i];
+        poison->id = -1;
+        poison->payload = (Line){ NULL, 0, NULL, 0 };
+        poison->cost = INT_MAX;
+        poison->priority = 0;
+        clock_gettime(CLOCK_MONOTONIC, &poison->arrival_time);
+        insertJob(&g->rs, poison);
+    }
+}
+
+static void suite_global_destroy(void *q) {
+    rs_destroy(&((SuiteGlobal *)q)->rs);
+    free(q);
+}
+
+static void *suite_ws_create(int policy, size_t cap) {
+    Scheduler *s = malloc(sizeof *s);
+    (void)cap;
+    if (!s) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    ws_init(s, policy);
+    return s;
+}
+
+static void suite_ws_put(void *q, BenchJob *b) {
+    Job *job = suite_job(b);
+    ws_submit_batch(q, &job, 1);
+}
+
+static BenchJob *suite_ws_get(void *q, int self) {
+    Job *job = ws_next(&((Scheduler *)q)->rq[self], NULL);
+    return job ? bench_job_of(job) : NULL;
+}
+
+static void suite_ws_stop(void *q, int ncons) {
+    (void)ncons;
+    ws_stop(q);
+}
+
+static void suite_ws_destroy(void *q) {
+    ws_destroy(q);
+    free(q);
+}
+
+#define SUITE_CASES(name, policy) \
+    { "scheduling_policies", "global", name, policy, BENCH_MAX_THREADS, BENCH_MAX_THREADS, 1, \
+      sizeof(Job), suite_global_create, suite_global_put, suite_global_get, \
+      suite_global_stop, suite_global_destroy }, \
+    { "scheduling_policies", "stealing", name, policy, NUM_PROD, NUM_CONS, 0, \
+      sizeof(Job), suite_ws_create, suite_ws_put, suite_ws_get, suite_ws_stop, suite_ws_destroy }
+
+void bench_register_scheduling_policies(void) {
+    static const BenchCase cases[] = {
+        SUITE_CASES("FCFS", FCFS),
+        SUITE_CASES("SJF", SJF),
+        SUITE_CASES("PRIORITY", PRIORITY),
+    };
+    (void)producer;
+    (void)consumer;
+    (void)ws_consumer;
+    (void)trace;
+    (void)replay;
+    (void)input;
+    (void)policy_names;
+    for (size_t i = 0; i < sizeof cases / sizeof cases[0]; i++) bench_add(&cases[i]);
+}
+
+#else
+
+/* The thread bodies main() starts, one set per policy plus the generic one. */
+typedef struct PolicyLoops {
+    void *(*producer)(void *);
+    void *(*consumer)(void *);
+    void *(*ws_consumer)(void *);
+} PolicyLoops;
+
+#define POLICY_LOOPS(P) \
+    static void flush_jobs_##P(void *sched, void **items, size_t n) { \
+        flush_jobs_as(sched, items, n, P); \
+    } \
+    static void *producer_##P(void *arg) { return producer_as(arg, flush_jobs_##P); } \
+    static void *consumer_##P(void *arg) { return consumer_as(arg, P); } \
+    static void *ws_consumer_##P(void *arg) { return ws_consumer_as(arg, P); }
+
+POLICY_LOOPS(FCFS)
+POLICY_LOOPS(SJF)
+POLICY_LOOPS(PRIORITY)
+
+static const PolicyLoops policy_loops[] = {
+    [FCFS]     = { producer_FCFS, consumer_FCFS, ws_consumer_FCFS },
+    [SJF]      = { producer_SJF, consumer_SJF, ws_consumer_SJF },
+    [PRIORITY] = { producer_PRIORITY, consumer_PRIORITY, ws_consumer_PRIORITY },
+};
+static const PolicyLoops generic_loops = { producer, consumer, ws_consumer };
+
+/* With a job trace (job_trace.h) as argv[1], jobs are replayed from it;
+ * stdin then only picks the policy. */
+int main(int argc, char **argv) {
 
     ReadySet *rs = malloc(sizeof *rs); 
     if (!rs) {
@@ -158,19 +1075,44 @@ int main(void) {
     pthread_t cons_threads[NUM_CONS];
 
     int choice;
+    Line first = { NULL, 0, NULL, 0 };
+    lr_init(&input, STDIN_FILENO);
+    input.shared = NUM_PROD > 1;
+    if (ORDERED_OUTPUT) reorder_init(&reorder, STDOUT_FILENO, 0);
     printf("Kindly pick the scheduling policy:\n");
     printf("0 = FCFS\n1 = SJF\n2 = PRIORITY\n> ");
-    if (scanf("%d", &choice) != 1) { 
+    fflush(stdout);
+    if (!lr_next(&input, &first) || !line_to_int(&first, &choice)) { 
     fprintf(stderr, "Invalid input. Defaulting to FCFS.\n");
     choice = 0;
 }
+    line_release(&first);
+    if (argc > 1) {
+        trace_open(&trace, argv[1]);
+        replay = &trace;
+    }
+    wl_seed((uint64_t)time(NULL));
+    src_init(&source, &input, replay, NUM_PROD, 1, 10, 1, MAX_PRIO);
 
     if(choice == 0) rs->policy = FCFS;
     if(choice == 1) rs-> policy = SJF;
     if(choice == 2) rs->policy = PRIORITY;
+    lat_watch(policy_names[rs->policy], 1);
+    const PolicyLoops *loops = SPECIALIZE ? &policy_loops[rs->policy] : &generic_loops;
+
+    Scheduler *sched = NULL;
+    if (WORK_STEALING) {
+        sched = malloc(sizeof *sched);
+        if (!sched) {
+            perror("malloc sched");
+            exit(EXIT_FAILURE);
+        }
+        ws_init(sched, rs->policy);
+    }
 
     for (int k = 0; k < NUM_PROD; ++k) {
-        if (pthread_create(&prod_threads[k], NULL, producer, rs) != 0) {
+        void *parg = WORK_STEALING ? (void *)sched : (void *)rs;
+        if (pthread_create(&prod_threads[k], NULL, loops->producer, parg) != 0) {
             perror("pthread_create producer");
             exit(EXIT_FAILURE);
         }
@@ -178,7 +1120,10 @@ int main(void) {
 
     
     for (int i = 0; i < NUM_CONS; ++i) {
-        if (pthread_create(&cons_threads[i], NULL, consumer, rs) != 0) {
+        int rc = WORK_STEALING
+            ? pthread_create(&cons_threads[i], NULL, loops->ws_consumer, &sched->rq[i])
+            : pthread_create(&cons_threads[i], NULL, loops->consumer, rs);
+        if (rc != 0) {
             perror("pthread_create consumer");
             exit(EXIT_FAILURE);
         }
@@ -189,12 +1134,16 @@ int main(void) {
         pthread_join(prod_threads[k], NULL);
     }
 
-    for (int i = 0; i < NUM_CONS; ++i) {
-       Job *poison = malloc(sizeof *poison);
+    if (WORK_STEALING) ws_stop(sched);
+
+    for (int i = 0; !WORK_STEALING && i < NUM_CONS; ++i) {
+       Job *poison = pool_alloc(sizeof *poison);
         poison->id = -1;
-        poison->payload = NULL;
-        poison->cost = 0;
+        poison->payload = (Line){ NULL, 0, NULL, 0 };
+        /* sorts after every real job so SJF drains the set before exiting */
+        poison->cost = INT_MAX;
         poison->priority = 0;
+        clock_gettime(CLOCK_MONOTONIC, &poison->arrival_time);
 
         insertJob(rs, poison);
     }
@@ -203,6 +1152,16 @@ int main(void) {
         pthread_join(cons_threads[i], NULL);
     }
 
+    if (WORK_STEALING) {
+        ws_destroy(sched);
+        free(sched);
+    }
+    if (ORDERED_OUTPUT) reorder_close(&reorder);
+    if (LAT_STATS) lat_report(stderr, policy_names[rs->policy], 1);
+    if (replay) trace_close(replay);
+    lr_close(&input);
     rs_destroy(rs);
     return 0;
 }
+
+#endif
@@ -1,29 +1,165 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
 #include <string.h>
 #include <time.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <stdarg.h>
+#include <limits.h>
 
+#include "job_pool.h"
+#include "line_reader.h"
+#include "out_writer.h"
+#include "des_sim.h"
+#include "green.h"
+#include "job_trace.h"
+#include "workload.h"
+#include "lat_hist.h"
+#include "sched_keys.h"
+
+#ifndef NUM_PROD
 #define NUM_PROD 1
+#endif
 #define NUM_CONS 7
 #define QUANTA 5
+#define MAX_PRIO 100      /* producer draws priority from 1..MAX_PRIO */
+#define HEAP_ARITY 4
+#define CACHE_LINE 64
+
+/* 1 = per-consumer run queues with stealing, 0 = one global ReadySet */
+#ifndef WORK_STEALING
+#define WORK_STEALING 1
+#endif
+
+/* 1 = discrete-event simulation on one shared virtual clock (see
+ * des_sim.h) instead of consumer threads with clocks of their own */
+#ifndef SIMULATE
+#define SIMULATE 0
+#endif
+
+/* mean virtual time between arrivals: ~79% load on NUM_CONS cpus */
+#ifndef SIM_MEAN_GAP
+#define SIM_MEAN_GAP 1
+#endif
+
+/* 1 = each job is a green thread (green.h) doing cost units of real cpu
+ * work, GREEN_UNIT_US each. Under RR a per-consumer cpu-time timer ends the
+ * quantum, and the job yields at its next safe point. */
+#ifndef GREEN
+#define GREEN 0
+#endif
+#define GREEN_UNIT_US 1000
+#define GREEN_CHECK   256               /* work rounds between safe points */
+
+/* Most jobs the producer queues on one consumer. A job can be overtaken by
+ * at most NUM_CONS * LOCAL_DEPTH later arrivals, so this is the knob that
+ * trades global ordering against contention. */
+#ifndef LOCAL_DEPTH
+#define LOCAL_DEPTH 16
+#endif
+
+/* EDF: a job with no deadline of its own (a trace can give one) has to
+ * finish within EDF_SLACK times its cost of arriving, or half that if its
+ * priority is in the upper half */
+#ifndef EDF_SLACK
+#define EDF_SLACK 4
+#endif
 
-static int next_job_id = 0;
+/* 1 = EDF demotes a job that cannot make its deadline at the current
+ * backlog to a best-effort FIFO behind every admitted job, 0 = admits all */
+#ifndef EDF_ADMIT
+#define EDF_ADMIT 1
+#endif
 
-enum policy { FCFS, SJF, PRIORITY, RR };
+/* CFS: a job's slice is its weight's share of CFS_LATENCY units, spread
+ * over the jobs runnable on its queue, but never under CFS_MIN_GRAN units
+ * per job of average weight: with many jobs the period stretches to
+ * their count times CFS_MIN_GRAN instead */
+#ifndef CFS_LATENCY
+#define CFS_LATENCY 20
+#endif
+#ifndef CFS_MIN_GRAN
+#define CFS_MIN_GRAN 2
+#endif
+#define CFS_VUNIT (16 * MAX_PRIO)       /* vruntime per unit of cost at weight 1 */
+
+/* 1 = main() runs a copy of the producer and consumer loops built for the
+ * chosen policy, 0 = the generic loops, which look at the policy on every
+ * put, take and slice */
+#ifndef SPECIALIZE
+#define SPECIALIZE 1
+#endif
+
+/* The queue code below takes the policy as an argument and is forced inline
+ * into each per-policy loop (POLICY_LOOPS), where the policy is a constant:
+ * the branches on it fold away and only that policy's structure is left.
+ * The plain-named versions pass rs->policy and are the runtime fallback. */
+#define POLICY_INLINE static inline __attribute__((always_inline))
+
+/* jobs admitted but not yet finished; RR, CFS, STRIDE and LOTTERY jobs go
+ * back into the set after every slice, so poison may only be queued once this reaches zero */
+static int live_jobs = 0;
+static pthread_mutex_t live_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  all_done = PTHREAD_COND_INITIALIZER;
+
+static void job_done(void) {
+    if (__sync_sub_and_fetch(&live_jobs, 1) == 0) {
+        pthread_mutex_lock(&live_mtx);
+        pthread_cond_broadcast(&all_done);
+        pthread_mutex_unlock(&live_mtx);
+    }
+}
+
+enum policy { FCFS, SJF, PRIORITY, RR, EDF, CFS, STRIDE, LOTTERY };
+
+static const char *policy_names[] = {
+    "FCFS", "SJF", "PRIORITY", "RR", "EDF", "CFS", "STRIDE", "LOTTERY"
+};
 
 typedef struct job {
     int id;
-    char *payload;
+    Line payload;                       /* view into the input, ptr NULL = poison */
     int priority;
     int cost;                 
     struct timespec arrival_time;
+    long deadline;                      /* EDF, absolute, see edf_admit() */
+    int demoted;                        /* EDF, failed admission */
+    int density;                        /* EDF, in EDF_ONE fixed point */
+    long vruntime;                      /* CFS, STRIDE's pass, see cfs_put() */
+    int slice;                          /* CFS, units it may run when picked */
+    JobTimes times;                     /* LAT_STATS */
+    struct job *next;
+    char *log;                          /* ORDERED_OUTPUT: lines not yet emitted */
+    size_t log_len, log_cap;
+    SimJob sim;                         /* SIMULATE only */
+    Green *green;                       /* GREEN only */
+    uint32_t sum;                       /* GREEN's work, kept live */
 } Job;
 
+typedef struct JobList {
+    Job *head;
+    Job *tail;
+} JobList;
+
 typedef struct ReadySet {
-    Job **jobs;
+    Job **jobs;                         /* SJF, EDF, CFS, STRIDE: a 4-ary min-heap;
+                                           LOTTERY: its jobs, in no order */
+    uint64_t *keys;                     /* keys[i] orders jobs[i] */
+    long *fen;                          /* LOTTERY: Fenwick tree over the shares
+                                           of jobs[], 1-based, room + 1 long */
+    uint64_t seq;                       /* arrivals to the heap so far */
+    size_t heaped;                      /* jobs in the heap (or LOTTERY's jobs[]) */
+    size_t room;                        /* slots in jobs and keys, >= cap */
     size_t cap;
     size_t count;
+    long min_vruntime;                  /* CFS, STRIDE, never goes back */
+    long vbase;                         /* CFS, STRIDE: vruntime keyed as 0 */
+    long weight;                        /* CFS, STRIDE, LOTTERY: shares queued */
+    JobList fifo;                       /* FCFS, RR, EDF's demoted jobs */
+    JobList prio[MAX_PRIO + 1];         /* PRIORITY, bucket 0 holds poison */
+    uint64_t prio_bitmap[(MAX_PRIO + 64) / 64];
     pthread_mutex_t mtx;
     pthread_cond_t not_full;
     pthread_cond_t not_empty;
@@ -32,17 +168,27 @@ typedef struct ReadySet {
 
 static void rs_init(ReadySet *rs, size_t cap) {
     rs->jobs = malloc(cap * sizeof *rs->jobs);
-    if (!rs->jobs) {
+    rs->keys = malloc(cap * sizeof *rs->keys);
+    rs->fen = calloc(cap + 1, sizeof *rs->fen);
+    if (!rs->jobs || !rs->keys || !rs->fen) {
         perror("malloc jobs");
         exit(EXIT_FAILURE);
     }
-    rs->cap = cap;
+    rs->room = rs->cap = cap;
     rs->count = 0;
+    rs->seq = 0;
+    rs->heaped = 0;
+    rs->min_vruntime = 0;
+    rs->vbase = 0;
+    rs->weight = 0;
     rs->policy = FCFS;   
+    memset(&rs->fifo, 0, sizeof rs->fifo);
+    memset(rs->prio, 0, sizeof rs->prio);
+    memset(rs->prio_bitmap, 0, sizeof rs->prio_bitmap);
 
     pthread_mutex_init(&rs->mtx, NULL);
     pthread_cond_init(&rs->not_full, NULL);
-    pthread_cond_init(&rs->not_empty, NULL);
+    out_cond_init(&rs->not_empty);
 }
 
 static void rs_destroy(ReadySet *rs) {
@@ -50,52 +196,277 @@ static void rs_destroy(ReadySet *rs) {
     pthread_cond_destroy(&rs->not_empty);
     pthread_mutex_destroy(&rs->mtx);
     free(rs->jobs);
+    free(rs->keys);
+    free(rs->fen);
 }
 
-static void insertJob(ReadySet *rs, Job *job) {
-    pthread_mutex_lock(&rs->mtx);
-    while (rs->count == rs->cap) {
-        pthread_cond_wait(&rs->not_full, &rs->mtx);
+static void fen_build(ReadySet *rs);
+
+/* Doubles the slots behind the heap, not cap: cap is what producers wait
+ * on, room is only what the arrays can hold. */
+static void rs_grow(ReadySet *rs) {
+    rs->room *= 2;
+    rs->jobs = realloc(rs->jobs, rs->room * sizeof *rs->jobs);
+    rs->keys = realloc(rs->keys, rs->room * sizeof *rs->keys);
+    rs->fen = realloc(rs->fen, (rs->room + 1) * sizeof *rs->fen);
+    if (!rs->jobs || !rs->keys || !rs->fen) {
+        perror("realloc jobs");
+        exit(EXIT_FAILURE);
     }
-    rs->jobs[rs->count] = job;
-    rs->count++;
-    pthread_cond_signal(&rs->not_empty);
-    pthread_mutex_unlock(&rs->mtx);
+    if (rs->policy == LOTTERY) fen_build(rs);
 }
 
-static Job *removeJob(ReadySet *rs) {
-    pthread_mutex_lock(&rs->mtx);
-    while (rs->count == 0) {
-        pthread_cond_wait(&rs->not_empty, &rs->mtx);
+static void list_push(JobList *l, Job *job) {
+    job->next = NULL;
+    if (l->tail) l->tail->next = job;
+    else         l->head = job;
+    l->tail = job;
+}
+
+static Job *list_pop(JobList *l) {
+    Job *job = l->head;
+    l->head = job->next;
+    if (!l->head) l->tail = NULL;
+    return job;
+}
+
+/* PRIORITY keeps one FIFO list per priority level plus a bitmap of the
+ * non-empty ones, like the Linux O(1) scheduler: pick the highest set bit,
+ * pop the head of that list. Equal priorities come out in arrival order. */
+static void prio_push(ReadySet *rs, Job *job) {
+    int p = job->priority;
+    list_push(&rs->prio[p], job);
+    rs->prio_bitmap[p / 64] |= 1ULL << (p % 64);
+}
+
+static Job *prio_pop(ReadySet *rs) {
+    int w = (int)(sizeof rs->prio_bitmap / sizeof rs->prio_bitmap[0]) - 1;
+    while (rs->prio_bitmap[w] == 0) w--;
+    int p = w * 64 + 63 - __builtin_clzll(rs->prio_bitmap[w]);
+
+    Job *job = list_pop(&rs->prio[p]);
+    if (!rs->prio[p].head) rs->prio_bitmap[w] &= ~(1ULL << (p % 64));
+    return job;
+}
+
+/* SJF, EDF and CFS keep rs->jobs as a 4-ary min-heap: shortest cost
+ * (earliest deadline, least vruntime) first, earlier arrival on ties. The heap orders rs->keys
+ * (sched_keys.h), major over arrival sequence, and moves rs->jobs along
+ * with them, so a sift never loads a Job. */
+static void heap_push(ReadySet *rs, Job *job, long major) {
+    uint64_t key = key_pack(major, rs->seq++);
+    size_t i = rs->heaped++;
+    while (i > 0) {
+        size_t parent = (i - 1) / HEAP_ARITY;
+        if (key > rs->keys[parent]) break;
+        rs->jobs[i] = rs->jobs[parent];
+        rs->keys[i] = rs->keys[parent];
+        i = parent;
     }
+    rs->jobs[i] = job;
+    rs->keys[i] = key;
+}
 
-    size_t best = 0;
+static Job *heap_pop(ReadySet *rs) {
+    Job *top = rs->jobs[0];
+    size_t n = --rs->heaped;
+    Job *last = rs->jobs[n];
+    uint64_t last_key = rs->keys[n];
+    size_t i = 0;
+
+    for (;;) {
+        size_t first = i * HEAP_ARITY + 1;
+        if (first >= n) break;
+        size_t end = first + HEAP_ARITY < n ? first + HEAP_ARITY : n;
+        size_t best = first + key_argmin(&rs->keys[first], end - first);
+        if (rs->keys[best] > last_key) break;
+        rs->jobs[i] = rs->jobs[best];
+        rs->keys[i] = rs->keys[best];
+        i = best;
+    }
+    if (n > 0) {
+        rs->jobs[i] = last;
+        rs->keys[i] = last_key;
+    }
+    return top;
+}
+
+/* A job's share of the cpu under CFS, STRIDE and LOTTERY: its priority,
+ * as a weight or a ticket count. */
+static inline int job_share(const Job *job) {
+    return job->priority > 0 ? job->priority : 1;   /* poison has 0 */
+}
+
+/* CFS: a job is charged virtual runtime for what it runs, CFS_VUNIT per
+ * unit of cost divided by its share, so over time every job gets cpu in
+ * proportion to its priority. The heap runs the least vruntime first. Off
+ * the heap a job only carries its lag over rs->min_vruntime, which is 0
+ * for a new arrival: a job starts level with the jobs waiting, and a
+ * stolen one moves to its new queue's clock instead of bringing the old
+ * one along.
+ *
+ * STRIDE is the same bookkeeping with a fixed QUANTA slice: vruntime is
+ * the job's pass, CFS_VUNIT / share its stride, min_vruntime the global
+ * pass and the lag the "remain" a job keeps while it is off the queue.
+ *
+ * The heap keys vruntime - rs->vbase, not vruntime itself, which would
+ * pass KEY_MAJOR_MAX and clamp there, and the policy with it to FIFO. */
+
+/* Moves vbase up to min_vruntime. No queued job is behind min_vruntime, so
+ * every key's major shifts down by the same amount and the order holds. */
+static void cfs_rebase(ReadySet *rs) {
+    uint64_t d = (uint64_t)(rs->min_vruntime - rs->vbase) << KEY_SEQ_BITS;
+    for (size_t i = 0; i < rs->heaped; i++) rs->keys[i] -= d;
+    rs->vbase = rs->min_vruntime;
+}
+
+/* Lags are far below KEY_MAJOR_MAX / 2, so rebasing once min_vruntime is
+ * that far past vbase keeps every key under the clamp. */
+static void cfs_put(ReadySet *rs, Job *job) {
+    job->vruntime += rs->min_vruntime;
+    rs->weight += job_share(job);
+    if (rs->min_vruntime - rs->vbase > (long)(KEY_MAJOR_MAX / 2)) cfs_rebase(rs);
+    heap_push(rs, job, job->vruntime - rs->vbase);
+}
 
-    switch (rs->policy) {
+/* job was just popped, so its vruntime is the least in rs: that becomes
+ * min_vruntime. */
+static void cfs_picked(ReadySet *rs, Job *job) {
+    rs->weight -= job_share(job);
+    if (job->vruntime > rs->min_vruntime) rs->min_vruntime = job->vruntime;
+    job->vruntime -= rs->min_vruntime;
+}
+
+/* CFS: the slice of a job just picked (after cfs_picked()) is its share
+ * of the period, counting it as runnable with everything still queued. */
+static int cfs_slice(const ReadySet *rs, const Job *job) {
+    long w = job_share(job), nr = (long)rs->count;     /* count still has job */
+    long period = nr * CFS_MIN_GRAN > CFS_LATENCY ? nr * CFS_MIN_GRAN : CFS_LATENCY;
+    long slice = period * w / (rs->weight + w);
+    return slice > 0 ? (int)slice : 1;
+}
+
+static inline void cfs_charge(Job *job, int ran) {
+    job->vruntime += (long)ran * CFS_VUNIT / job_share(job);
+}
+
+/* LOTTERY keeps its jobs unordered in rs->jobs[0..heaped) and a Fenwick
+ * tree over their shares (tickets) in rs->fen, so drawing a ticket and
+ * finding whose it is, and adding or removing a job, are O(log n). A
+ * removed job's slot is filled by the last job, so the array stays dense.
+ * Winners are drawn from the calling thread's workload.h generator. */
+static void fen_add(ReadySet *rs, size_t slot, long d) {
+    for (size_t i = slot + 1; i <= rs->room; i += i & -i) rs->fen[i] += d;
+}
+
+/* slot holding ticket r, 0 <= r < rs->weight */
+static size_t fen_find(const ReadySet *rs, long r) {
+    size_t pos = 0;
+    for (size_t step = (size_t)1 << (63 - __builtin_clzll(rs->room)); step; step >>= 1) {
+        if (pos + step <= rs->room && rs->fen[pos + step] <= r) {
+            pos += step;
+            r -= rs->fen[pos];
+        }
+    }
+    return pos;
+}
+
+/* from scratch in O(n), after rs->room changed */
+static void fen_build(ReadySet *rs) {
+    for (size_t i = 1; i <= rs->room; i++) {
+        rs->fen[i] = i <= rs->heaped ? job_share(rs->jobs[i - 1]) : 0;
+    }
+    for (size_t i = 1; i <= rs->room; i++) {
+        size_t up = i + (i & -i);
+        if (up <= rs->room) rs->fen[up] += rs->fen[i];
+    }
+}
+
+static void lot_put(ReadySet *rs, Job *job) {
+    size_t slot = rs->heaped++;
+    rs->jobs[slot] = job;
+    fen_add(rs, slot, job_share(job));
+    rs->weight += job_share(job);
+}
+
+static Job *lot_pop(ReadySet *rs) {
+    long r = (long)(((unsigned __int128)wl_next() * (uint64_t)rs->weight) >> 64);
+    size_t slot = fen_find(rs, r), last = --rs->heaped;
+    Job *job = rs->jobs[slot];
+
+    fen_add(rs, slot, -job_share(job));
+    if (slot != last) {
+        Job *moved = rs->jobs[last];
+        fen_add(rs, last, -job_share(moved));
+        fen_add(rs, slot, job_share(moved));
+        rs->jobs[slot] = moved;
+    }
+    rs->weight -= job_share(job);
+    return job;
+}
+
+/* rs_put/rs_take do the policy-specific bookkeeping; callers hold rs->mtx
+ * and have already checked for room / for a job. */
+POLICY_INLINE void rs_put_as(ReadySet *rs, Job *job, enum policy policy) {
+    switch (policy) {
+    case SJF:
+        heap_push(rs, job, job->cost);
+        break;
+    case EDF:
+        if (job->demoted) list_push(&rs->fifo, job);
+        else              heap_push(rs, job, job->deadline);
+        break;
+    case PRIORITY:
+        prio_push(rs, job);
+        break;
+    case CFS:
+    case STRIDE:
+        cfs_put(rs, job);
+        break;
+    case LOTTERY:
+        lot_put(rs, job);
+        break;
+    default:
+        list_push(&rs->fifo, job);
+        break;
+    }
+    rs->count++;
+}
+
+POLICY_INLINE Job *rs_take_as(ReadySet *rs, enum policy policy) {
+    Job *job;
+
+    switch (policy) {
     case FCFS:
-        best = 0;
+    case RR:
+        job = list_pop(&rs->fifo);
         break;
 
     case SJF:
-        best = 0;
-        for (size_t i = 1; i < rs->count; i++) {
-            if (rs->jobs[i]->cost < rs->jobs[best]->cost) {
-                best = i;
-            }
-        }
+        job = heap_pop(rs);
         break;
 
     case PRIORITY:
-        best = 0;
-        for (size_t i = 1; i < rs->count; i++) {
-            if (rs->jobs[i]->priority > rs->jobs[best]->priority) {
-                best = i;
-            }
-        }
+        job = prio_pop(rs);
         break;
 
-    case RR:
-        best = 0;
+    case EDF:
+        job = rs->heaped ? heap_pop(rs) : list_pop(&rs->fifo);
+        break;
+
+    case CFS:
+        job = heap_pop(rs);
+        cfs_picked(rs, job);
+        job->slice = cfs_slice(rs, job);
+        break;
+
+    case STRIDE:
+        job = heap_pop(rs);
+        cfs_picked(rs, job);
+        break;
+
+    case LOTTERY:
+        job = lot_pop(rs);
         break;
 
     default:
@@ -103,91 +474,1073 @@ static Job *removeJob(ReadySet *rs) {
         fprintf(stderr, "Unknown policy\n");
         exit(EXIT_FAILURE);
     }
-
-    Job *job = rs->jobs[best];
-    rs->jobs[best] = rs->jobs[rs->count - 1];
     rs->count--;
+    return job;
+}
+
+static void rs_put(ReadySet *rs, Job *job) {
+    rs_put_as(rs, job, rs->policy);
+}
+
+static Job *rs_take(ReadySet *rs) {
+    return rs_take_as(rs, rs->policy);
+}
+
+POLICY_INLINE void insertJob_as(ReadySet *rs, Job *job, enum policy policy) {
+    pthread_mutex_lock(&rs->mtx);
+    while (rs->count >= rs->cap) {
+        pthread_cond_wait(&rs->not_full, &rs->mtx);
+    }
+    rs_put_as(rs, job, policy);
+    pthread_cond_signal(&rs->not_empty);
+    pthread_mutex_unlock(&rs->mtx);
+}
+
+/* Puts back a job a consumer is holding after a slice. It never waits for
+ * room: if every consumer blocked here while the producer filled the set,
+ * nobody would be left to drain it. Only RR requeues go on a list; the
+ * others need a slot in jobs[], so past cap the arrays grow instead. */
+POLICY_INLINE void requeueJob_as(ReadySet *rs, Job *job, enum policy policy) {
+    pthread_mutex_lock(&rs->mtx);
+    if (rs->count == rs->room) rs_grow(rs);
+    rs_put_as(rs, job, policy);
+    pthread_cond_signal(&rs->not_empty);
+    pthread_mutex_unlock(&rs->mtx);
+}
+
+/* Returns NULL if deadline (when not NULL) passes with the set still empty. */
+POLICY_INLINE Job *removeJob_as(ReadySet *rs, const struct timespec *deadline,
+                                enum policy policy) {
+    pthread_mutex_lock(&rs->mtx);
+    while (rs->count == 0) {
+        if (!deadline) {
+            pthread_cond_wait(&rs->not_empty, &rs->mtx);
+        } else if (pthread_cond_timedwait(&rs->not_empty, &rs->mtx, deadline) == ETIMEDOUT) {
+            pthread_mutex_unlock(&rs->mtx);
+            return NULL;
+        }
+    }
+
+    Job *job = rs_take_as(rs, policy);
 
     pthread_cond_signal(&rs->not_full);
     pthread_mutex_unlock(&rs->mtx);
     return job;
 }
 
-static void *producer(void *arg) {
-    ReadySet *rs = arg;
-    char buf[256];
+static void insertJob(ReadySet *rs, Job *job) {
+    insertJob_as(rs, job, rs->policy);
+}
 
-    while (fgets(buf, sizeof buf, stdin)) {
-        char *copy = strdup(buf);
-        if (!copy) {
-            perror("strdup");
-            exit(EXIT_FAILURE);
+static inline void requeueJob(ReadySet *rs, Job *job) {
+    requeueJob_as(rs, job, rs->policy);
+}
+
+static inline Job *removeJob(ReadySet *rs, const struct timespec *deadline) {
+    return removeJob_as(rs, deadline, rs->policy);
+}
+
+/* EDF bookkeeping. Deadlines are absolute, in units of cost: virtual time
+ * under SIMULATE, otherwise GREEN_UNIT_US of wall time since edf_epoch,
+ * which is what a unit of cost takes to run with GREEN (without it a job
+ * takes next to no time and no deadline is ever close).
+ *
+ * Admission is the density test for global EDF on NUM_CONS cpus (Goossens,
+ * Funk and Baruah): the jobs in the system can all make their deadlines
+ * if the sum of their densities, cost / (deadline - arrival), stays within
+ * NUM_CONS - (NUM_CONS - 1) * the largest density. Both are over the
+ * admitted jobs not yet finished: edf_load holds the sum, in EDF_ONE fixed
+ * point, and above it the top of edf_live, which counts those jobs by
+ * density rounded up to 1/EDF_BUCKETS, so the largest density is known to
+ * within that and lowered again when its last job finishes. A job that
+ * would push the sum past the bound is demoted: it still runs, but from a
+ * FIFO behind every admitted job, and its misses are counted apart. */
+#define EDF_ONE     65536
+#define EDF_BUCKETS 64
+#define EDF_SUM_BITS 48
+#define EDF_SUM_MASK ((1ull << EDF_SUM_BITS) - 1)
+
+static uint64_t edf_epoch;
+static _Atomic uint64_t edf_load;       /* density sum | top bucket << EDF_SUM_BITS */
+static _Atomic long edf_live[EDF_BUCKETS + 1];
+static _Atomic long edf_admitted, edf_missed;
+static _Atomic long edf_demoted, edf_demoted_missed;
+
+static long edf_now(void) {
+    return (long)((lat_now() - edf_epoch) / (GREEN_UNIT_US * 1000ull));
+}
+
+/* deadline_us is the job's own relative deadline, 0 if it has none */
+static long edf_budget(const Job *job, uint64_t deadline_us) {
+    long unit_us = SIMULATE ? TRACE_UNIT_US : GREEN_UNIT_US;
+    if (deadline_us) return (long)((deadline_us + (uint64_t)unit_us - 1) / (uint64_t)unit_us);
+    long slack = job->priority > MAX_PRIO / 2 ? (EDF_SLACK + 1) / 2 : EDF_SLACK;
+    return slack * job->cost;
+}
+
+static inline int edf_bucket(long d) {
+    return (int)((d * EDF_BUCKETS + EDF_ONE - 1) / EDF_ONE);
+}
+
+/* highest bucket with a job in it, 0 if none */
+static int edf_top(void) {
+    int b = EDF_BUCKETS;
+    while (b > 0 && !atomic_load(&edf_live[b])) b--;
+    return b;
+}
+
+/* Takes a job of density d out of bucket b and d out of the sum, and
+ * lowers the top if that emptied it. */
+static void edf_release(int b, long d) {
+    atomic_fetch_sub(&edf_live[b], 1);
+    uint64_t cur = atomic_load(&edf_load), next;
+    do {
+        int top = (int)(cur >> EDF_SUM_BITS);
+        if (top == b && !atomic_load(&edf_live[b])) top = edf_top();
+        next = ((cur & EDF_SUM_MASK) - (uint64_t)d) | (uint64_t)top << EDF_SUM_BITS;
+    } while (!atomic_compare_exchange_weak(&edf_load, &cur, next));
+}
+
+/* job arrives at now with budget units to finish in */
+static void edf_admit(Job *job, long budget, long now) {
+    long d = budget > job->cost ? (long)job->cost * EDF_ONE / budget : EDF_ONE;
+    int b = edf_bucket(d);
+
+    job->deadline = now + budget;
+    job->density = (int)d;
+    job->demoted = 0;
+
+    /* counted before the sum is reserved, so an edf_top() racing with
+     * this never lowers the top below b */
+    atomic_fetch_add(&edf_live[b], 1);
+    uint64_t cur = atomic_load(&edf_load), next;
+    do {
+        uint64_t load = (cur & EDF_SUM_MASK) + (uint64_t)d;
+        int top = (int)(cur >> EDF_SUM_BITS);
+        if (b > top) top = b;
+        long bound = NUM_CONS * EDF_ONE - (NUM_CONS - 1) * ((long)top * EDF_ONE / EDF_BUCKETS);
+        if (EDF_ADMIT && (long)load > bound) {
+            job->demoted = 1;
+            break;
         }
+        next = load | (uint64_t)top << EDF_SUM_BITS;
+    } while (!atomic_compare_exchange_weak(&edf_load, &cur, next));
 
-        Job *job = malloc(sizeof *job);
-        if (!job) {
-            perror("malloc job");
-            exit(EXIT_FAILURE);
+    if (job->demoted) {
+        edf_release(b, 0);
+        atomic_fetch_add_explicit(&edf_demoted, 1, memory_order_relaxed);
+        return;
+    }
+    atomic_fetch_add_explicit(&edf_admitted, 1, memory_order_relaxed);
+}
+
+static void edf_finish(const Job *job, long now) {
+    if (!job->demoted) edf_release(edf_bucket(job->density), job->density);
+    if (now <= job->deadline) return;
+    atomic_fetch_add_explicit(job->demoted ? &edf_demoted_missed : &edf_missed, 1,
+                              memory_order_relaxed);
+}
+
+/* elapsed is in units of per: "s", or "unit" of virtual time */
+static void edf_report(FILE *f, double elapsed, const char *per) {
+    long admitted = atomic_load(&edf_admitted), missed = atomic_load(&edf_missed);
+    long demoted = atomic_load(&edf_demoted), demoted_missed = atomic_load(&edf_demoted_missed);
+    long jobs = admitted + demoted;
+
+    fprintf(f, "EDF: %ld jobs, %.2f jobs/%s, deadline misses %.2f%%\n", jobs,
+            elapsed > 0 ? (double)jobs / elapsed : 0.0, per,
+            jobs ? 100.0 * (double)(missed + demoted_missed) / (double)jobs : 0.0);
+    fprintf(f, "EDF: admitted %ld, missed %ld (%.2f%%); demoted %ld, missed %ld\n",
+            admitted, missed, admitted ? 100.0 * (double)missed / (double)admitted : 0.0,
+            demoted, demoted_missed);
+}
+
+/* Work stealing: every consumer owns a run queue, the producer spreads
+ * jobs over them and a consumer that runs dry steals from its neighbours.
+ * A timesliced job that still has work left goes back on the queue of the
+ * consumer that just ran it, so re-queues never leave that consumer.
+ *
+ * FCFS and RR queues are Chase-Lev deques used as FIFOs: pushes go to the
+ * bottom (serialised by push_mtx, since the producer is not the owner) and
+ * the owner and thieves alike take from the top with one CAS. Every other
+ * policy's queues are small private ReadySets, so CFS, STRIDE and LOTTERY
+ * share out each consumer's cpu among the jobs queued on it. */
+typedef struct Deque {
+    _Alignas(CACHE_LINE) _Atomic size_t top;
+    _Alignas(CACHE_LINE) _Atomic size_t bottom;
+    _Atomic(Job *) *buf;
+    size_t mask;
+} Deque;
+
+typedef struct Scheduler Scheduler;
+
+typedef struct RunQueue {
+    Deque dq;
+    ReadySet local;
+    pthread_mutex_t push_mtx;
+    _Alignas(CACHE_LINE) _Atomic int load;   /* >= jobs queued here */
+    Scheduler *sched;
+    int self;
+} RunQueue;
+
+struct Scheduler {
+    RunQueue rq[NUM_CONS];
+    enum policy policy;
+    _Atomic unsigned next;          /* producers' rotating start point */
+    _Atomic int idle;               /* consumers parked on work */
+    _Atomic int prod_waiting;       /* producers parked on space */
+    _Atomic int stop;
+    pthread_mutex_t idle_mtx;
+    pthread_cond_t work;
+    pthread_cond_t space;
+};
+
+static int uses_deque(enum policy policy) {
+    return policy == FCFS || policy == RR;
+}
+
+static void dq_init(Deque *dq, size_t cap) {
+    size_t n = 1;
+    while (n < cap) n <<= 1;
+    dq->buf = malloc(n * sizeof *dq->buf);
+    if (!dq->buf) {
+        perror("malloc deque");
+        exit(EXIT_FAILURE);
+    }
+    dq->mask = n - 1;
+    atomic_init(&dq->top, 0);
+    atomic_init(&dq->bottom, 0);
+}
+
+static void dq_push(Deque *dq, Job *job) {
+    size_t b = atomic_load_explicit(&dq->bottom, memory_order_relaxed);
+    atomic_store_explicit(&dq->buf[b & dq->mask], job, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&dq->bottom, b + 1, memory_order_relaxed);
+}
+
+static Job *dq_steal(Deque *dq) {
+    for (;;) {
+        size_t t = atomic_load_explicit(&dq->top, memory_order_acquire);
+        atomic_thread_fence(memory_order_seq_cst);
+        size_t b = atomic_load_explicit(&dq->bottom, memory_order_acquire);
+        if (t >= b) return NULL;
+
+        Job *job = atomic_load_explicit(&dq->buf[t & dq->mask], memory_order_relaxed);
+        if (atomic_compare_exchange_strong_explicit(&dq->top, &t, t + 1,
+                memory_order_seq_cst, memory_order_relaxed)) {
+            return job;
+        }
+    }
+}
+
+POLICY_INLINE void rq_push_as(RunQueue *rq, Job *job, enum policy policy) {
+    atomic_fetch_add(&rq->load, 1);
+    if (uses_deque(policy)) {
+        pthread_mutex_lock(&rq->push_mtx);
+        dq_push(&rq->dq, job);
+        pthread_mutex_unlock(&rq->push_mtx);
+    } else {
+        pthread_mutex_lock(&rq->local.mtx);
+        rs_put_as(&rq->local, job, policy);
+        pthread_mutex_unlock(&rq->local.mtx);
+    }
+}
+
+POLICY_INLINE Job *rq_take(RunQueue *rq, enum policy policy) {
+    Job *job = NULL;
+    if (uses_deque(policy)) {
+        job = dq_steal(&rq->dq);
+    } else {
+        pthread_mutex_lock(&rq->local.mtx);
+        if (rq->local.count) job = rs_take_as(&rq->local, policy);
+        pthread_mutex_unlock(&rq->local.mtx);
+    }
+    if (job) atomic_fetch_sub(&rq->load, 1);
+    return job;
+}
+
+/* The deque holds at most LOCAL_DEPTH - 1 + NUM_PROD jobs from the
+ * producers (each may add one on the same stale load) plus the one RR job
+ * its owner is running, so 2 * LOCAL_DEPTH never wraps. */
+_Static_assert(NUM_PROD <= LOCAL_DEPTH, "deques sized for NUM_PROD <= LOCAL_DEPTH");
+
+static void ws_init(Scheduler *s, enum policy policy) {
+    s->policy = policy;
+    atomic_init(&s->next, 0);
+    atomic_init(&s->idle, 0);
+    atomic_init(&s->prod_waiting, 0);
+    atomic_init(&s->stop, 0);
+    pthread_mutex_init(&s->idle_mtx, NULL);
+    out_cond_init(&s->work);
+    pthread_cond_init(&s->space, NULL);
+
+    for (int i = 0; i < NUM_CONS; i++) {
+        RunQueue *rq = &s->rq[i];
+        dq_init(&rq->dq, 2 * LOCAL_DEPTH);
+        rs_init(&rq->local, 2 * LOCAL_DEPTH);
+        rq->local.policy = policy;
+        pthread_mutex_init(&rq->push_mtx, NULL);
+        atomic_init(&rq->load, 0);
+        rq->sched = s;
+        rq->self = i;
+    }
+}
+
+static void ws_destroy(Scheduler *s) {
+    for (int i = 0; i < NUM_CONS; i++) {
+        free(s->rq[i].dq.buf);
+        rs_destroy(&s->rq[i].local);
+        pthread_mutex_destroy(&s->rq[i].push_mtx);
+    }
+    pthread_cond_destroy(&s->space);
+    pthread_cond_destroy(&s->work);
+    pthread_mutex_destroy(&s->idle_mtx);
+}
+
+/* Least-loaded queue, scanning from a rotating start so ties spread
+ * round-robin; -1 if every queue is already LOCAL_DEPTH deep. */
+static int ws_pick(Scheduler *s) {
+    unsigned start = atomic_fetch_add_explicit(&s->next, 1, memory_order_relaxed);
+    int best = -1, best_load = LOCAL_DEPTH;
+    for (int k = 0; k < NUM_CONS; k++) {
+        int i = (int)((start + k) % NUM_CONS);
+        int load = atomic_load(&s->rq[i].load);
+        if (load < best_load) {
+            best = i;
+            best_load = load;
+            if (load == 0) break;
+        }
+    }
+    return best;
+}
+
+POLICY_INLINE void ws_submit_as(Scheduler *s, Job *job, enum policy policy) {
+    int i = ws_pick(s);
+    if (i < 0) {
+        pthread_mutex_lock(&s->idle_mtx);
+        atomic_fetch_add(&s->prod_waiting, 1);
+        while ((i = ws_pick(s)) < 0) {
+            pthread_cond_wait(&s->space, &s->idle_mtx);
+        }
+        atomic_fetch_sub(&s->prod_waiting, 1);
+        pthread_mutex_unlock(&s->idle_mtx);
+    }
+
+    rq_push_as(&s->rq[i], job, policy);
+    if (atomic_load(&s->idle)) {
+        pthread_mutex_lock(&s->idle_mtx);
+        pthread_cond_signal(&s->work);
+        pthread_mutex_unlock(&s->idle_mtx);
+    }
+}
+
+/* Own queue first, then the neighbours in ring order. */
+POLICY_INLINE Job *ws_find(RunQueue *rq, enum policy policy) {
+    Scheduler *s = rq->sched;
+    for (int k = 0; k < NUM_CONS; k++) {
+        Job *job = rq_take(&s->rq[(rq->self + k) % NUM_CONS], policy);
+        if (job) return job;
+    }
+    return NULL;
+}
+
+/* A consumer took a job: one producer waiting for room can retry. */
+static void ws_took(Scheduler *s) {
+    if (atomic_load(&s->prod_waiting)) {
+        pthread_mutex_lock(&s->idle_mtx);
+        pthread_cond_signal(&s->space);
+        pthread_mutex_unlock(&s->idle_mtx);
+    }
+}
+
+/* Blocks until there is a job anywhere, or returns NULL once ws_stop() has
+ * been called and every queue is empty, or once deadline (when not NULL)
+ * passes. idle is raised before the last scan and read by ws_submit()
+ * after its push, so a job queued while we fall asleep always comes with a
+ * signal. */
+POLICY_INLINE Job *ws_next_as(RunQueue *rq, const struct timespec *deadline,
+                              enum policy policy) {
+    Scheduler *s = rq->sched;
+    Job *job = ws_find(rq, policy);
+
+    if (!job) {
+        pthread_mutex_lock(&s->idle_mtx);
+        atomic_fetch_add(&s->idle, 1);
+        while (!(job = ws_find(rq, policy)) && !atomic_load(&s->stop)) {
+            if (!deadline) {
+                pthread_cond_wait(&s->work, &s->idle_mtx);
+            } else if (pthread_cond_timedwait(&s->work, &s->idle_mtx, deadline) == ETIMEDOUT) {
+                job = ws_find(rq, policy);
+                break;
+            }
+        }
+        atomic_fetch_sub(&s->idle, 1);
+        pthread_mutex_unlock(&s->idle_mtx);
+    }
+
+    if (job) ws_took(s);
+    return job;
+}
+
+static inline void rq_push(RunQueue *rq, Job *job) {
+    rq_push_as(rq, job, rq->sched->policy);
+}
+
+static inline void ws_submit(Scheduler *s, Job *job) {
+    ws_submit_as(s, job, s->policy);
+}
+
+static inline Job *ws_next(RunQueue *rq, const struct timespec *deadline) {
+    return ws_next_as(rq, deadline, rq->sched->policy);
+}
+
+static void ws_stop(Scheduler *s) {
+    pthread_mutex_lock(&s->idle_mtx);
+    atomic_store(&s->stop, 1);
+    pthread_cond_broadcast(&s->work);
+    pthread_mutex_unlock(&s->idle_mtx);
+}
+
+static LineReader input;               /* stdin, shared by the producers */
+static Trace trace;
+static Trace *replay;                   /* &trace if argv[1] named one */
+static JobSource source;
+static Reorder reorder;                 /* ORDERED_OUTPUT only */
+
+/* GREEN: a unit of cost is unit_spins green_mix() rounds over a hash of
+ * the payload. Progress lives on the job's own stack, so a unit cut short
+ * resumes where it stopped. */
+static long unit_spins = 1;
+
+static void job_body(void *arg) {
+    Job *job = arg;
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < job->payload.len; i++) {
+        h = (h ^ (unsigned char)job->payload.ptr[i]) * 16777619u;
+    }
+    while (job->cost > 0) {
+        for (long r = 0; r < unit_spins; r++) {
+            h = green_mix(h);
+            if (r % GREEN_CHECK == GREEN_CHECK - 1) green_check(job->green);
         }
+        job->cost--;
+    }
+    job->sum = h;
+}
+
+/* arg is the Scheduler with WORK_STEALING, the global ReadySet without */
+POLICY_INLINE void *producer_as(void *arg, enum policy policy) {
+    JobDraw d;
+    WlPacer pacer;
 
-        job->id = next_job_id++;
-        job->payload = copy;
-        job->cost = rand() % 10 + 1;       // "burst time"
-        job->priority = rand() % 100 + 1;
+    wl_pacer_init(&pacer);
+    while (src_next(&source, &pacer, &d)) {
+        Job *job = pool_alloc(sizeof *job);
+        job->id = (int)d.id;
+        job->payload = d.payload;
+        job->log = NULL;
+        job->log_len = job->log_cap = 0;
+        job->cost = d.cost;                // "burst time"
+        job->priority = d.priority;
         clock_gettime(CLOCK_MONOTONIC, &job->arrival_time);
+        lat_arrive(&job->times, lat_ns(&job->arrival_time));
+        if (policy == EDF) edf_admit(job, edf_budget(job, d.deadline_us), edf_now());
+        job->vruntime = 0;
+        if (GREEN) {
+            job->green = pool_alloc(sizeof *job->green);
+            green_init(job->green, job_body, job);
+        }
 
-        insertJob(rs, job);
+        __sync_fetch_and_add(&live_jobs, 1);
+        if (WORK_STEALING) ws_submit_as(arg, job, policy);
+        else               insertJob_as(arg, job, policy);
     }
 
     return NULL;
 }
 
-static void *consumer(void *arg) {
-    ReadySet *rs = arg;
+static void *producer(void *arg) {
+    return producer_as(arg, WORK_STEALING ? ((Scheduler *)arg)->policy
+                                          : ((ReadySet *)arg)->policy);
+}
+
+/* Unordered, a job's lines go straight to the consumer's writer. With
+ * ORDERED_OUTPUT they stay with the job until it finishes, so each job's
+ * slices come out together and jobs come out in id order. */
+static void job_printf(Job *job, Writer *out, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+
+    if (!ORDERED_OUTPUT) {
+        out_vprintf(out, fmt, ap);
+    } else {
+        char line[128];
+        int n = vsnprintf(line, sizeof line, fmt, ap);
+        if (n > (int)sizeof line - 1) n = (int)sizeof line - 1;
+
+        if (job->log_len + (size_t)n > job->log_cap) {
+            size_t cap = job->log_cap ? 2 * job->log_cap : 128;
+            char *log = pool_alloc(cap);
+            memcpy(log, job->log, job->log_len);
+            pool_free(job->log);
+            job->log = log;
+            job->log_cap = cap;
+        }
+        memcpy(job->log + job->log_len, line, (size_t)n);
+        job->log_len += (size_t)n;
+    }
+    va_end(ap);
+}
+
+/* Most a job may run when picked: the slice cfs_slice() gave it under
+ * CFS, QUANTA under the other timesliced policies, 0 = to the end. */
+POLICY_INLINE int quantum_of(const Job *job, enum policy policy) {
+    if (policy == CFS) return job->slice;
+    if (policy == RR || policy == STRIDE || policy == LOTTERY) return QUANTA;
+    return 0;
+}
+
+/* policies that charge a job's vruntime for what it ran */
+POLICY_INLINE int uses_vruntime(enum policy policy) {
+    return policy == CFS || policy == STRIDE;
+}
+
+/* How long job runs when picked: one quantum, or to the end if it has
+ * less left or the policy has none. */
+POLICY_INLINE int slice_of(const Job *job, enum policy policy) {
+    int q = quantum_of(job, policy);
+    if (q && job->cost > q) return q;
+    return job->cost;
+}
+
+/* GREEN: runs job on its own stack until it finishes or, under a
+ * timesliced policy, this thread has spent a quantum of cpu on it. Returns the units it
+ * got through, already taken off job->cost. */
+POLICY_INLINE int green_slice(Job *job, enum policy policy) {
+    int before = job->cost, q = quantum_of(job, policy);
+    if (q) green_timer_arm((long)q * GREEN_UNIT_US);
+    green_run(job->green, green_timer_flag());
+    if (q) green_timer_arm(0);
+    return before - job->cost;
+}
+
+/* Runs one slice of job (all of it unless policy is timesliced). Returns
+ * 1 if the job still has work left and must be queued again. */
+POLICY_INLINE int run_job(Job *job, enum policy policy, int *current_time, Writer *out) {
+    lat_dispatch(&job->times, 0);
+    if (quantum_of(job, policy)) {
+        int slice;
+        if (GREEN) {
+            slice = green_slice(job, policy);
+        } else {
+            slice = slice_of(job, policy);
+            job->cost -= slice;
+        }
+
+        job_printf(job, out, "Job %d ran from %d to %d (remaining %d)\n",
+                   job->id, *current_time, *current_time + slice,
+                   job->cost);
+
+        *current_time += slice;
+        lat_ran(&job->times, 0);
+        if (uses_vruntime(policy)) cfs_charge(job, slice);
+
+        if (job->cost > 0) {
+            return 1;
+        }
+        job_printf(job, out, "Job %d finished at time %d\n",
+                   job->id, *current_time);
+    } else {
+        int cost = job->cost;
+        if (GREEN) green_slice(job, policy);
+
+        job_printf(job, out, "Job %d ran from %d to %d (finished)\n",
+                   job->id, *current_time, *current_time + cost);
+
+        *current_time += cost;
+        lat_ran(&job->times, 0);
+        if (policy == EDF) edf_finish(job, edf_now());
+    }
+    lat_done(&job->times, 0);
+
+    if (ORDERED_OUTPUT) reorder_text(&reorder, job->id, job->log, job->log_len);
+    line_release(&job->payload);
+    if (GREEN) pool_free(job->green);
+    pool_free(job);
+    job_done();
+    return 0;
+}
+
+POLICY_INLINE void *consumer_as(ReadySet *rs, enum policy policy) {
     int current_time = 0; 
+    Writer out;
 
+    out_init(&out, STDOUT_FILENO);
+    if (GREEN) green_timer_init();
     for (;;) {
-        Job *job = removeJob(rs);
-        if (job->payload == NULL) {   
-            free(job);
+        struct timespec linger;
+        Job *job = removeJob_as(rs, out_deadline(&out, &linger) ? &linger : NULL, policy);
+        if (!job) {
+            out_flush(&out);            /* idle for OUT_LINGER_US */
+            pool_flush();
+            job = removeJob_as(rs, NULL, policy);
+        }
+        if (job->payload.ptr == NULL) {   
+            pool_free(job);
             break;
         }
 
-        if (rs->policy == RR) {
-            int slice = (job->cost > QUANTA) ? QUANTA : job->cost;
+        if (run_job(job, policy, &current_time, &out)) {
+            requeueJob_as(rs, job, policy);
+        }
+    }
 
-            printf("Job %d ran from %d to %d (remaining %d)\n",
-                   job->id, current_time, current_time + slice,
-                   job->cost - slice);
+    if (GREEN) green_timer_destroy();
+    out_close(&out);
+    pool_flush();
+    return NULL;
+}
 
-            job->cost      -= slice;
-            current_time   += slice;
+POLICY_INLINE void *ws_consumer_as(RunQueue *rq, enum policy policy) {
+    int current_time = 0;
+    Writer out;
+    Job *job;
 
-            if (job->cost > 0) {
+    out_init(&out, STDOUT_FILENO);
+    if (GREEN) green_timer_init();
+    for (;;) {
+        struct timespec linger;
+        if (!(job = ws_next_as(rq, out_deadline(&out, &linger) ? &linger : NULL, policy))) {
+            out_flush(&out);            /* idle for OUT_LINGER_US, or stopped */
+            pool_flush();
+            if (!(job = ws_next_as(rq, NULL, policy))) break;
+        }
+        if (run_job(job, policy, &current_time, &out)) {
+            rq_push_as(rq, job, policy);
+        }
+    }
+    if (GREEN) green_timer_destroy();
+    out_close(&out);
+    pool_flush();
+    return NULL;
+}
 
-                insertJob(rs, job);
-            } else {
-                printf("Job %d finished at time %d\n",
-                       job->id, current_time);
-                free(job->payload);
-                free(job);
-            }
-        } else {
-           
-            printf("Job %d ran from %d to %d (finished)\n",
-                   job->id, current_time, current_time + job->cost);
+static void *consumer(void *arg) {
+    ReadySet *rs = arg;
+    return consumer_as(rs, rs->policy);
+}
+
+static void *ws_consumer(void *arg) {
+    RunQueue *rq = arg;
+    return ws_consumer_as(rq, rq->sched->policy);
+}
 
-            current_time += job->cost;
-            free(job->payload);
-            free(job);
+/* Simulation mode: the ReadySet's own policy code picks the jobs, on the
+ * main thread only, so the set is used without its lock. Jobs are put in
+ * the set in virtual arrival order, which is the order SJF breaks ties in. */
+static SimJob *sim_arrive(void *ctx) {
+    JobDraw d;
+    (void)ctx;
+
+    if (!src_next(&source, NULL, &d)) return NULL;
+    Job *job = pool_alloc(sizeof *job);
+    job->id = (int)d.id;
+    job->payload = d.payload;
+    job->log = NULL;
+    job->log_len = job->log_cap = 0;
+    job->cost = d.cost;
+    job->priority = d.priority;
+    job->sim.arrival = d.arrival;
+    job->sim.id = job->id;
+    job->sim.service = job->cost;
+    job->deadline = edf_budget(job, d.deadline_us);   /* relative until it arrives */
+    job->vruntime = 0;
+    return &job->sim;
+}
+
+static void sim_put(ReadySet *rs, Job *job) {
+    if (rs->count == rs->room) rs_grow(rs);   /* nothing blocks in a simulation */
+    rs_put(rs, job);
+}
+
+static void sim_ready(void *ctx, SimJob *s) {
+    ReadySet *rs = ctx;
+    Job *job = SIM_OWNER(s, Job);
+    if (rs->policy == EDF) edf_admit(job, job->deadline, s->arrival);
+    sim_put(rs, job);
+}
+
+static SimJob *sim_pick(void *ctx, long *slice) {
+    ReadySet *rs = ctx;
+    if (rs->count == 0) return NULL;
+
+    Job *job = rs_take(rs);
+    *slice = slice_of(job, rs->policy);
+    return &job->sim;
+}
+
+static int sim_ran(void *ctx, SimJob *s, long slice) {
+    Job *job = SIM_OWNER(s, Job);
+    job->cost -= (int)slice;
+    if (job->cost <= 0) return 1;
+    if (uses_vruntime(((ReadySet *)ctx)->policy)) cfs_charge(job, (int)slice);
+    sim_put(ctx, job);
+    return 0;
+}
+
+static long sim_makespan;
+
+static void sim_done(void *ctx, SimJob *s) {
+    ReadySet *rs = ctx;
+    Job *job = SIM_OWNER(s, Job);
+    if (rs->policy == EDF) edf_finish(job, s->finish);
+    if (s->finish > sim_makespan) sim_makespan = s->finish;
+    line_release(&job->payload);
+    pool_free(job);
+}
+
+static void simulate(ReadySet *rs) {
+    SimPolicy p = {
+        .ctx = rs,
+        .arrive = sim_arrive,
+        .ready = sim_ready,
+        .pick = sim_pick,
+        .ran = sim_ran,
+        .done = sim_done,
+        .tick = NULL,
+        .tick_period = 0,
+        .mean_gap = SIM_MEAN_GAP,
+    };
+    sim_run(&p, NUM_CONS);
+    if (rs->policy == EDF) edf_report(stderr, (double)sim_makespan, "unit");
+}
+
+#ifdef BENCH
+/* gcc -O2 -DBENCH -pthread simulated_RR.c -o rr_bench -lm
+ *
+ * The proportional-share policies on one ReadySet, driven directly: each
+ * dispatch takes a job, runs its slice_of() and puts it back. Jobs never
+ * finish, so the set stays the same size throughout. */
+#define BENCH_DISPATCHES 1000000
+
+static double bench_now_ns(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+static Job *bench_jobs(ReadySet *rs, enum policy policy, size_t n, int random_prio) {
+    Job *jobs = calloc(n, sizeof *jobs);
+    if (!jobs) {
+        perror("calloc jobs");
+        exit(EXIT_FAILURE);
+    }
+    rs->policy = policy;
+    for (size_t i = 0; i < n; i++) {
+        jobs[i].id = (int)i;
+        jobs[i].cost = INT_MAX;
+        jobs[i].priority = random_prio ? wl_range(1, MAX_PRIO) : (int)(i % MAX_PRIO) + 1;
+        rs_put(rs, &jobs[i]);
+    }
+    return jobs;
+}
+
+/* one take, slice and put; the units the job ran */
+static inline int bench_dispatch(ReadySet *rs, long *got) {
+    Job *job = rs_take(rs);
+    int slice = slice_of(job, rs->policy);
+    if (uses_vruntime(rs->policy)) cfs_charge(job, slice);
+    got[job->id] += slice;
+    rs_put(rs, job);
+    return slice;
+}
+
+/* Share accuracy: MAX_PRIO jobs, one at each priority, so job i is owed
+ * (i + 1) / (MAX_PRIO (MAX_PRIO + 1) / 2) of the units handed out. Reports
+ * how far the units each job got are from that: the total variation over
+ * all jobs (half the summed absolute differences, as a fraction of all
+ * units), and the worst single job's error relative to its own share.
+ * clock starts min_vruntime there, to check shares past KEY_MAJOR_MAX. */
+static void bench_share(enum policy policy, long clock) {
+    ReadySet rs;
+    long got[MAX_PRIO] = { 0 }, total = 0;
+
+    rs_init(&rs, MAX_PRIO);
+    rs.min_vruntime = clock;
+    Job *jobs = bench_jobs(&rs, policy, MAX_PRIO, 0);
+    for (int d = 0; d < BENCH_DISPATCHES; d++) total += bench_dispatch(&rs, got);
+
+    double tickets = MAX_PRIO * (MAX_PRIO + 1) / 2.0, tv = 0, worst = 0;
+    for (int i = 0; i < MAX_PRIO; i++) {
+        double owed = (double)total * (i + 1) / tickets;
+        double off = (double)got[i] - owed;
+        tv += off < 0 ? -off : off;
+        double rel = (off < 0 ? -off : off) / owed;
+        if (rel > worst) worst = rel;
+    }
+    printf("%-8s %12ld %14.4f%% %14.2f%%%s\n", policy_names[policy], total,
+           100.0 * tv / 2 / (double)total, 100.0 * worst, clock ? "  (clock past the key clamp)" : "");
+    rs_destroy(&rs);
+    free(jobs);
+}
+
+/* Dispatch cost: ns per take + put with n jobs ready, priorities uniform
+ * over 1..MAX_PRIO. */
+static void bench_dispatch_cost(enum policy policy, size_t n) {
+    ReadySet rs;
+    long *got = calloc(n, sizeof *got);
+    if (!got) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+
+    rs_init(&rs, n);
+    Job *jobs = bench_jobs(&rs, policy, n, 1);
+    double t0 = bench_now_ns();
+    for (int d = 0; d < BENCH_DISPATCHES; d++) bench_dispatch(&rs, got);
+    printf("%-8s %10zu %12.1f\n", policy_names[policy], n,
+           (bench_now_ns() - t0) / BENCH_DISPATCHES);
+    rs_destroy(&rs);
+    free(jobs);
+    free(got);
+}
+
+int main(void) {
+    static const enum policy shares[] = { RR, CFS, STRIDE, LOTTERY };
+    /* the real pipeline is not run here */
+    (void)producer;
+    (void)consumer;
+    (void)ws_consumer;
+    (void)ws_init;
+    (void)ws_stop;
+    (void)ws_destroy;
+    (void)rq_push;
+    (void)ws_submit;
+    (void)ws_next;
+    (void)requeueJob;
+    (void)removeJob;
+    (void)insertJob;
+    (void)simulate;
+    (void)trace;
+    (void)replay;
+    (void)input;
+    (void)edf_admit;
+    (void)edf_report;
+    wl_seed(1);
+
+    printf("%-8s %12s %15s %15s\n", "policy", "units", "share off", "worst job off");
+    for (size_t i = 0; i < sizeof shares / sizeof shares[0]; i++) bench_share(shares[i], 0);
+    bench_share(CFS, (long)KEY_MAJOR_MAX * 4);
+    bench_share(STRIDE, (long)KEY_MAJOR_MAX * 4);
+
+    printf("\n%-8s %10s %12s\n", "policy", "ready", "ns/dispatch");
+    for (size_t n = 1000; n <= 100000; n *= 10) {
+        for (size_t i = 0; i < sizeof shares / sizeof shares[0]; i++) {
+            bench_dispatch_cost(shares[i], n);
         }
     }
+    return 0;
+}
+
+#elif defined(BENCH_SUITE)
+/* The global ReadySet and the work-stealing Scheduler, under each policy,
+ * in bench/bench.c's suite. The queued element is a Job. A job's cost is
+ * used up without doing anything, one slice_of() per pick, so under RR it
+ * goes round the queue until its cost runs out and only then comes out of
+ * get(). */
+#include "bench/bench.h"
+
+typedef struct SuiteGlobal {
+    ReadySet rs;
+    Job poison[BENCH_MAX_THREADS];
+} SuiteGlobal;
+
+static Job *suite_job(BenchJob *b) {
+    Job *job = (Job *)b->item;
+    job->id = (int)b->id;
+    job->payload = b->line;
+    job->cost = b->cost;
+    job->priority = b->priority;
+    clock_gettime(CLOCK_MONOTONIC, &job->arrival_time);
+    job->deadline = edf_now() + edf_budget(job, 0);   /* admitted, whatever the load */
+    job->demoted = 0;
+    job->vruntime = 0;
+    __sync_fetch_and_add(&live_jobs, 1);
+    return job;
+}
+
+/* Takes a slice off job; 1 if it is finished. */
+static int suite_ran(Job *job, enum policy policy) {
+    job->cost -= slice_of(job, policy);
+    if (job->cost > 0) return 0;
+    job_done();
+    return 1;
+}
+
+/* as main() does before it stops the consumers */
+static void suite_drain(void) {
+    pthread_mutex_lock(&live_mtx);
+    while (__atomic_load_n(&live_jobs, __ATOMIC_ACQUIRE) > 0) {
+        pthread_cond_wait(&all_done, &live_mtx);
+    }
+    pthread_mutex_unlock(&live_mtx);
+}
+
+static void *suite_global_create(int policy, size_t cap) {
+    SuiteGlobal *g = malloc(sizeof *g);
+    if (!g) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    rs_init(&g->rs, cap);
+    g->rs.policy = policy;
+    return g;
+}
+
+static void suite_global_put(void *q, BenchJob *b) {
+    insertJob(&((SuiteGlobal *)q)->rs, suite_job(b));
+}
+
+static BenchJob *suite_global_get(void *q, int self) {
+    ReadySet *rs = &((SuiteGlobal *)q)->rs;
+    (void)self;
+    for (;;) {
+        Job *job = removeJob(rs, NULL);
+        if (!job->payload.ptr) return NULL;
+        if (suite_ran(job, rs->policy)) return bench_job_of(job);
+        requeueJob(rs, job);
+    }
+}
+
+static void suite_global_stop(void *q, int ncons) {
+    SuiteGlobal *g = q;
+    suite_drain();
+    for (int i = 0; i < ncons; i++) {
+        Job *poison = &g->poison[i];
+        poison->id = -1;
+        poison->payload = (Line){ NULL, 0, NULL, 0 };
+        poison->cost = 0;
+        poison->priority = 0;
+        poison->deadline = LONG_MAX;
+        poison->demoted = 0;
+        poison->vruntime = 0;
+        insertJob(&g->rs, poison);
+    }
+}
 
+static void suite_global_destroy(void *q) {
+    rs_destroy(&((SuiteGlobal *)q)->rs);
+    free(q);
+}
+
+static void *suite_ws_create(int policy, size_t cap) {
+    Scheduler *s = malloc(sizeof *s);
+    (void)cap;
+    if (!s) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    ws_init(s, policy);
+    return s;
+}
+
+static void suite_ws_put(void *q, BenchJob *b) {
+    ws_submit(q, suite_job(b));
+}
+
+static BenchJob *suite_ws_get(void *q, int self) {
+    RunQueue *rq = &((Scheduler *)q)->rq[self];
+    Job *job;
+    while ((job = ws_next(rq, NULL))) {
+        if (suite_ran(job, rq->sched->policy)) return bench_job_of(job);
+        rq_push(rq, job);
+    }
     return NULL;
 }
 
-int main(void) {
+static void suite_ws_stop(void *q, int ncons) {
+    (void)ncons;
+    suite_drain();
+    ws_stop(q);
+}
+
+static void suite_ws_destroy(void *q) {
+    ws_destroy(q);
+    free(q);
+}
+
+#define SUITE_CASES(name, policy) \
+    { "simulated_RR", "global", name, policy, BENCH_MAX_THREADS, BENCH_MAX_THREADS, 1, \
+      sizeof(Job), suite_global_create, suite_global_put, suite_global_get, \
+      suite_global_stop, suite_global_destroy }, \
+    { "simulated_RR", "stealing", name, policy, NUM_PROD, NUM_CONS, 0, \
+      sizeof(Job), suite_ws_create, suite_ws_put, suite_ws_get, suite_ws_stop, suite_ws_destroy }
+
+void bench_register_simulated_RR(void) {
+    static const BenchCase cases[] = {
+        SUITE_CASES("FCFS", FCFS),
+        SUITE_CASES("SJF", SJF),
+        SUITE_CASES("PRIORITY", PRIORITY),
+        SUITE_CASES("RR", RR),
+        SUITE_CASES("EDF", EDF),
+        SUITE_CASES("CFS", CFS),
+        SUITE_CASES("STRIDE", STRIDE),
+        SUITE_CASES("LOTTERY", LOTTERY),
+    };
+    (void)producer;
+    (void)consumer;
+    (void)ws_consumer;
+    (void)simulate;
+    (void)trace;
+    (void)replay;
+    (void)input;
+    (void)policy_names;
+    (void)edf_admit;
+    (void)edf_report;
+    for (size_t i = 0; i < sizeof cases / sizeof cases[0]; i++) bench_add(&cases[i]);
+}
+
+#else
+
+/* The thread bodies main() starts, one set per policy plus the generic one. */
+typedef struct PolicyLoops {
+    void *(*producer)(void *);
+    void *(*consumer)(void *);
+    void *(*ws_consumer)(void *);
+} PolicyLoops;
+
+#define POLICY_LOOPS(P) \
+    static void *producer_##P(void *arg) { return producer_as(arg, P); } \
+    static void *consumer_##P(void *arg) { return consumer_as(arg, P); } \
+    static void *ws_consumer_##P(void *arg) { return ws_consumer_as(arg, P); }
+
+POLICY_LOOPS(FCFS)
+POLICY_LOOPS(SJF)
+POLICY_LOOPS(PRIORITY)
+POLICY_LOOPS(RR)
+POLICY_LOOPS(EDF)
+POLICY_LOOPS(CFS)
+POLICY_LOOPS(STRIDE)
+POLICY_LOOPS(LOTTERY)
+
+static const PolicyLoops policy_loops[] = {
+    [FCFS]     = { producer_FCFS, consumer_FCFS, ws_consumer_FCFS },
+    [SJF]      = { producer_SJF, consumer_SJF, ws_consumer_SJF },
+    [PRIORITY] = { producer_PRIORITY, consumer_PRIORITY, ws_consumer_PRIORITY },
+    [RR]       = { producer_RR, consumer_RR, ws_consumer_RR },
+    [EDF]      = { producer_EDF, consumer_EDF, ws_consumer_EDF },
+    [CFS]      = { producer_CFS, consumer_CFS, ws_consumer_CFS },
+    [STRIDE]   = { producer_STRIDE, consumer_STRIDE, ws_consumer_STRIDE },
+    [LOTTERY]  = { producer_LOTTERY, consumer_LOTTERY, ws_consumer_LOTTERY },
+};
+static const PolicyLoops generic_loops = { producer, consumer, ws_consumer };
+
+/* With a job trace (job_trace.h) as argv[1], jobs are replayed from it;
+ * stdin then only picks the policy. */
+int main(int argc, char **argv) {
     srand((unsigned)time(NULL));
+    wl_seed((uint64_t)time(NULL));
 
     ReadySet rs;
     rs_init(&rs, 1024);
@@ -196,28 +1549,70 @@ int main(void) {
     pthread_t cons_threads[NUM_CONS];
 
     int choice;
+    Line first = { NULL, 0, NULL, 0 };
+    lr_init(&input, STDIN_FILENO);
+    input.shared = NUM_PROD > 1;
+    if (ORDERED_OUTPUT) reorder_init(&reorder, STDOUT_FILENO, 0);
+    if (GREEN) unit_spins = green_calibrate(GREEN_UNIT_US);
     printf("Choose scheduling policy:\n");
-    printf("0 = FCFS\n1 = SJF\n2 = PRIORITY\n3 = RR\n> ");
-    if (scanf("%d", &choice) != 1) {
+    printf("0 = FCFS\n1 = SJF\n2 = PRIORITY\n3 = RR\n4 = EDF\n5 = CFS\n6 = STRIDE\n7 = LOTTERY\n> ");
+    fflush(stdout);
+    if (!lr_next(&input, &first) || !line_to_int(&first, &choice)) {
         fprintf(stderr, "Invalid input, defaulting to FCFS\n");
         choice = 0;
     }
+    line_release(&first);
+    if (argc > 1) {
+        trace_open(&trace, argv[1]);
+        replay = &trace;
+    }
+    src_init(&source, &input, replay, NUM_PROD, 1, 10, 1, MAX_PRIO);
 
     if      (choice == 0) rs.policy = FCFS;
     else if (choice == 1) rs.policy = SJF;
     else if (choice == 2) rs.policy = PRIORITY;
     else if (choice == 3) rs.policy = RR;
+    else if (choice == 4) rs.policy = EDF;
+    else if (choice == 5) rs.policy = CFS;
+    else if (choice == 6) rs.policy = STRIDE;
+    else if (choice == 7) rs.policy = LOTTERY;
     else                  rs.policy = FCFS;
+    if (!SIMULATE) lat_watch(policy_names[rs.policy], 1);
+    edf_epoch = lat_now();
+    const PolicyLoops *loops = SPECIALIZE ? &policy_loops[rs.policy] : &generic_loops;
+
+    if (SIMULATE) {
+        simulate(&rs);
+        if (ORDERED_OUTPUT) reorder_close(&reorder);
+        if (replay) trace_close(replay);
+        lr_close(&input);
+        rs_destroy(&rs);
+        return 0;
+    }
+
+    Scheduler *sched = NULL;
+    if (WORK_STEALING) {
+        sched = malloc(sizeof *sched);
+        if (!sched) {
+            perror("malloc sched");
+            exit(EXIT_FAILURE);
+        }
+        ws_init(sched, rs.policy);
+    }
 
     for (int k = 0; k < NUM_PROD; ++k) {
-        if (pthread_create(&prod_threads[k], NULL, producer, &rs) != 0) {
+        void *parg = WORK_STEALING ? (void *)sched : (void *)&rs;
+        if (pthread_create(&prod_threads[k], NULL, loops->producer, parg) != 0) {
             perror("pthread_create producer");
             exit(EXIT_FAILURE);
         }
     }
 
     for (int i = 0; i < NUM_CONS; ++i) {
-        if (pthread_create(&cons_threads[i], NULL, consumer, &rs) != 0) {
+        int rc = WORK_STEALING
+            ? pthread_create(&cons_threads[i], NULL, loops->ws_consumer, &sched->rq[i])
+            : pthread_create(&cons_threads[i], NULL, loops->consumer, &rs);
+        if (rc != 0) {
             perror("pthread_create consumer");
             exit(EXIT_FAILURE);
         }
@@ -228,17 +1623,23 @@ int main(void) {
         pthread_join(prod_threads[k], NULL);
     }
 
+    pthread_mutex_lock(&live_mtx);
+    while (__atomic_load_n(&live_jobs, __ATOMIC_ACQUIRE) > 0) {
+        pthread_cond_wait(&all_done, &live_mtx);
+    }
+    pthread_mutex_unlock(&live_mtx);
+
+    if (WORK_STEALING) ws_stop(sched);
    
-    for (int i = 0; i < NUM_CONS; ++i) {
-        Job *poison = malloc(sizeof *poison);
-        if (!poison) {
-            perror("malloc poison");
-            exit(EXIT_FAILURE);
-        }
+    for (int i = 0; !WORK_STEALING && i < NUM_CONS; ++i) {
+        Job *poison = pool_alloc(sizeof *poison);
         poison->id = -1;
-        poison->payload = NULL;
+        poison->payload = (Line){ NULL, 0, NULL, 0 };
         poison->cost = 0;
         poison->priority = 0;
+        poison->deadline = LONG_MAX;
+        poison->demoted = 0;
+        poison->vruntime = 0;
         insertJob(&rs, poison);
     }
 
@@ -246,6 +1647,17 @@ int main(void) {
         pthread_join(cons_threads[i], NULL);
     }
 
+    if (WORK_STEALING) {
+        ws_destroy(sched);
+        free(sched);
+    }
+    if (ORDERED_OUTPUT) reorder_close(&reorder);
+    if (rs.policy == EDF) edf_report(stderr, (double)(lat_now() - edf_epoch) / 1e9, "s");
+    if (LAT_STATS) lat_report(stderr, policy_names[rs.policy], 1);
+    if (replay) trace_close(replay);
+    lr_close(&input);
     rs_destroy(&rs);
     return 0;
 }
+
+#endif
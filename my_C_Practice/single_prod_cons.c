@@ -1,11 +1,35 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
 #include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
+#include "batcher.h"
+#include "job_pool.h"
+#include "line_reader.h"
+
+#define CACHE_LINE 64
+#define SPIN_LIMIT 256
+
+/* most lines a consumer takes per removeJobBatch() */
+#ifndef DRAIN_MAX
+#define DRAIN_MAX 32
+#endif
+
+/* 1 = lock-free SPSC ring, 0 = mutex/condvar BoundedBuffer */
+#ifndef USE_SPSC
+#define USE_SPSC 1
+#endif
 
 typedef struct{
-    char **buf;
+    Line **buf;
     size_t cap;
     size_t count;
     size_t head;
@@ -15,7 +39,7 @@ typedef struct{
     pthread_cond_t not_null;
 } BoundedBuffer;
 
-void insertJob(BoundedBuffer *q, char *line){
+void insertJob(BoundedBuffer *q, Line *line){
 
     pthread_mutex_lock(&q->mtx);
     while(q->count == q->cap){
@@ -30,14 +54,14 @@ void insertJob(BoundedBuffer *q, char *line){
     pthread_mutex_unlock(&q->mtx);
 }
 
-char *removeJob(BoundedBuffer *q){
+Line *removeJob(BoundedBuffer *q){
 
     pthread_mutex_lock(&q->mtx);
     while(q->count == 0){
         pthread_cond_wait(&q->not_null, &q->mtx);
     }
 
-    char *line = q->buf[q->head];
+    Line *line = q->buf[q->head];
     q->head = (q->head + 1) % q->cap;
     q->count--;
 
@@ -47,38 +71,274 @@ char *removeJob(BoundedBuffer *q){
     return line;
 }
 
-void *producer(void *arg){
+/* Inserts all n lines, waking the consumer once per lock hold rather than
+ * once per line. */
+void insertJobBatch(BoundedBuffer *q, Line **lines, size_t n){
 
-    BoundedBuffer *q = arg;
-    char buf[256];
+    pthread_mutex_lock(&q->mtx);
+    while(n > 0){
+        while(q->count == q->cap){
+            pthread_cond_wait(&q->not_full, &q->mtx);
+        }
+        while(n > 0 && q->count < q->cap){
+            q->buf[q->tail] = *lines++;
+            q->tail = (q->tail + 1) % q->cap;
+            q->count++;
+            n--;
+        }
+        pthread_cond_signal(&q->not_null);
+    }
+    pthread_mutex_unlock(&q->mtx);
+}
 
-    while(fgets(buf, sizeof(buf), stdin)){
+/* Takes between 1 and max lines in one lock hold. A NULL (end of input)
+ * always ends the batch. */
+size_t removeJobBatch(BoundedBuffer *q, Line **out, size_t max){
 
-        char *copy = strdup(buf);
-        if(!copy){
-            perror("strdup");
-            exit(EXIT_FAILURE);
+    pthread_mutex_lock(&q->mtx);
+    while(q->count == 0){
+        pthread_cond_wait(&q->not_null, &q->mtx);
+    }
+
+    size_t k = 0;
+    while(k < max && q->count > 0){
+        Line *line = q->buf[q->head];
+        q->head = (q->head + 1) % q->cap;
+        q->count--;
+        out[k++] = line;
+        if(line == NULL) break;
+    }
+
+    pthread_cond_signal(&q->not_full);
+    pthread_mutex_unlock(&q->mtx);
+
+    return k;
+}
+
+/* Single-producer/single-consumer ring. head is written only by the
+ * consumer and tail only by the producer, each on its own cache line next
+ * to a cached copy of the other side's index, so the common case touches no
+ * shared line at all. Indices are free-running 32-bit counters (cap is a
+ * power of two) which doubles as the futex word a parked thread sleeps on. */
+typedef struct {
+    Line **buf;
+    uint32_t mask;
+
+    _Alignas(CACHE_LINE) _Atomic uint32_t head;
+    uint32_t tail_cache;
+    _Atomic uint32_t cons_waiting;
+
+    _Alignas(CACHE_LINE) _Atomic uint32_t tail;
+    uint32_t head_cache;
+    _Atomic uint32_t prod_waiting;
+} SpscRing;
+
+static void futex_wait(_Atomic uint32_t *addr, uint32_t val){
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void futex_wake(_Atomic uint32_t *addr){
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+static inline void cpu_relax(void){
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+void spsc_init(SpscRing *r, size_t cap){
+    size_t n = 1;
+    while(n < cap) n <<= 1;
+
+    r->buf = malloc(n * sizeof *r->buf);
+    if(!r->buf){
+        perror("malloc");
+        exit(1);
+    }
+    r->mask = (uint32_t)(n - 1);
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+    atomic_init(&r->cons_waiting, 0);
+    atomic_init(&r->prod_waiting, 0);
+    r->tail_cache = r->head_cache = 0;
+}
+
+void spsc_destroy(SpscRing *r){
+    free(r->buf);
+}
+
+/* Park on *word until it no longer holds val. The waiting flag is published
+ * before the final re-check; the other side stores its index and then reads
+ * the flag, both seq_cst, so one of the two always sees the other. The waker
+ * clears the flag as it wakes, so a parked thread costs one futex_wake, not
+ * one per item pushed while it was asleep. */
+static void spsc_park(_Atomic uint32_t *word, uint32_t val, _Atomic uint32_t *waiting){
+    for(int i = 0; i < SPIN_LIMIT; i++){
+        if(atomic_load_explicit(word, memory_order_acquire) != val) return;
+        cpu_relax();
+    }
+    for(;;){
+        atomic_store(waiting, 1);
+        if(atomic_load(word) != val) break;
+        futex_wait(word, val);
+    }
+    atomic_store_explicit(waiting, 0, memory_order_relaxed);
+}
+
+static void spsc_unpark(_Atomic uint32_t *word, _Atomic uint32_t *waiting){
+    if(atomic_load(waiting) && atomic_exchange(waiting, 0)){
+        futex_wake(word);
+    }
+}
+
+void spsc_insertJob(SpscRing *r, Line *line){
+    uint32_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+    if(tail - r->head_cache > r->mask){
+        r->head_cache = atomic_load_explicit(&r->head, memory_order_acquire);
+        while(tail - r->head_cache > r->mask){
+            spsc_park(&r->head, r->head_cache, &r->prod_waiting);
+            r->head_cache = atomic_load_explicit(&r->head, memory_order_acquire);
+        }
+    }
+
+    r->buf[tail & r->mask] = line;
+    atomic_store(&r->tail, tail + 1);
+    spsc_unpark(&r->tail, &r->cons_waiting);
+}
+
+Line *spsc_removeJob(SpscRing *r){
+    uint32_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+
+    if(head == r->tail_cache){
+        r->tail_cache = atomic_load_explicit(&r->tail, memory_order_acquire);
+        while(head == r->tail_cache){
+            spsc_park(&r->tail, head, &r->cons_waiting);
+            r->tail_cache = atomic_load_explicit(&r->tail, memory_order_acquire);
+        }
+    }
+
+    Line *line = r->buf[head & r->mask];
+    atomic_store(&r->head, head + 1);
+    spsc_unpark(&r->head, &r->prod_waiting);
+    return line;
+}
+
+/* Batched forms publish the new tail/head once per batch, so the other
+ * side sees one cache-line transfer and at most one wakeup per batch. */
+void spsc_insertJobBatch(SpscRing *r, Line **lines, size_t n){
+    uint32_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+    while(n > 0){
+        uint32_t room = r->mask + 1 - (tail - r->head_cache);
+        if(room < n){
+            r->head_cache = atomic_load_explicit(&r->head, memory_order_acquire);
+            while((room = r->mask + 1 - (tail - r->head_cache)) == 0){
+                spsc_park(&r->head, r->head_cache, &r->prod_waiting);
+                r->head_cache = atomic_load_explicit(&r->head, memory_order_acquire);
+            }
         }
-        insertJob(q, copy);
+
+        size_t k = room < n ? room : n;
+        for(size_t i = 0; i < k; i++){
+            r->buf[(tail + i) & r->mask] = lines[i];
+        }
+        lines += k;
+        n -= k;
+        tail += (uint32_t)k;
+        atomic_store(&r->tail, tail);
+        spsc_unpark(&r->tail, &r->cons_waiting);
     }
+}
 
-        insertJob(q, NULL);
+size_t spsc_removeJobBatch(SpscRing *r, Line **out, size_t max){
+    uint32_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    uint32_t avail = r->tail_cache - head;
+
+    if(avail < max){
+        r->tail_cache = atomic_load_explicit(&r->tail, memory_order_acquire);
+        while((avail = r->tail_cache - head) == 0){
+            spsc_park(&r->tail, head, &r->cons_waiting);
+            r->tail_cache = atomic_load_explicit(&r->tail, memory_order_acquire);
+        }
+    }
+
+    size_t k = 0;
+    while(k < max && k < avail){
+        Line *line = r->buf[(head + k) & r->mask];
+        out[k++] = line;
+        if(line == NULL) break;
+    }
+
+    atomic_store(&r->head, head + (uint32_t)k);
+    spsc_unpark(&r->head, &r->prod_waiting);
+    return k;
+}
+
+#if USE_SPSC
+typedef SpscRing Pipe;
+#define pipe_init    spsc_init
+#define pipe_destroy spsc_destroy
+#define pipe_put     spsc_insertJob
+#define pipe_get     spsc_removeJob
+#define pipe_put_batch spsc_insertJobBatch
+#define pipe_get_batch spsc_removeJobBatch
+#else
+typedef BoundedBuffer Pipe;
+#define pipe_init    q_init
+#define pipe_destroy q_destroy
+#define pipe_put     insertJob
+#define pipe_get     removeJob
+#define pipe_put_batch insertJobBatch
+#define pipe_get_batch removeJobBatch
+#endif
+
+static void flush_lines(void *q, void **items, size_t n){
+    pipe_put_batch(q, (Line **)items, n);
+}
+
+void *producer(void *arg){
+
+    Pipe *q = arg;
+    LineReader in;
+    Line l;
+    Batcher b;
+
+    lr_init(&in, STDIN_FILENO);
+    batcher_init(&b, q, flush_lines);
+    while(lr_next(&in, &l)){
+
+        Line *line = pool_alloc(sizeof *line);
+        *line = l;
+        batcher_add(&b, line);
+    }
+    batcher_close(&b);
+    lr_close(&in);
+
+        pipe_put(q, NULL);
         return NULL;
 
 }
 
 void *consumer(void *arg){
 
-    BoundedBuffer *q = arg;
+    Pipe *q = arg;
+    Line *lines[DRAIN_MAX];
 
     for(;;){
-        char *line = removeJob(q);
-        if(line == NULL) break;
-        fputs(line, stdout);
-        free(line);
+        size_t n = pipe_get_batch(q, lines, DRAIN_MAX);
+        for(size_t i = 0; i < n; i++){
+            if(lines[i] == NULL){
+                pool_flush();
+                return NULL;
+            }
+            line_write(lines[i], stdout);
+            line_release(lines[i]);
+            pool_free(lines[i]);
+        }
+        pool_flush();
     }
-
-    return NULL;
 }
 
 void q_init(BoundedBuffer *q, size_t cap){
@@ -102,10 +362,291 @@ void q_destroy(BoundedBuffer *q){
     free(q->buf);
 }
 
+#ifdef BENCH
+/* gcc -O2 -DBENCH -pthread single_prod_cons.c -o spc_bench
+ * ./spc_bench FILE     times ingestion of FILE (ideally several GB) instead */
+
+#define BENCH_LINES 20000000
+
+static Line bench_line = {"bench line\n", 11, NULL, 0};
+
+static double bench_now_s(void){
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static void *bench_mutex_prod(void *arg){
+    for(long i = 0; i < BENCH_LINES; i++) insertJob(arg, &bench_line);
+    insertJob(arg, NULL);
+    return NULL;
+}
+
+static void *bench_mutex_cons(void *arg){
+    long n = 0;
+    while(removeJob(arg)) n++;
+    return (void *)n;
+}
+
+static void *bench_spsc_prod(void *arg){
+    for(long i = 0; i < BENCH_LINES; i++) spsc_insertJob(arg, &bench_line);
+    spsc_insertJob(arg, NULL);
+    return NULL;
+}
+
+static void *bench_spsc_cons(void *arg){
+    long n = 0;
+    while(spsc_removeJob(arg)) n++;
+    return (void *)n;
+}
+
+static void *bench_mutex_batch_prod(void *arg){
+    Line *lines[BATCH_MAX];
+    for(int i = 0; i < BATCH_MAX; i++) lines[i] = &bench_line;
+    for(long i = 0; i < BENCH_LINES; i += BATCH_MAX) insertJobBatch(arg, lines, BATCH_MAX);
+    insertJob(arg, NULL);
+    return NULL;
+}
+
+static void *bench_mutex_batch_cons(void *arg){
+    Line *lines[DRAIN_MAX];
+    long n = 0;
+    for(;;){
+        size_t k = removeJobBatch(arg, lines, DRAIN_MAX);
+        if(lines[k - 1] == NULL) return (void *)(n + (long)k - 1);
+        n += (long)k;
+    }
+}
+
+static void *bench_spsc_batch_prod(void *arg){
+    Line *lines[BATCH_MAX];
+    for(int i = 0; i < BATCH_MAX; i++) lines[i] = &bench_line;
+    for(long i = 0; i < BENCH_LINES; i += BATCH_MAX) spsc_insertJobBatch(arg, lines, BATCH_MAX);
+    spsc_insertJob(arg, NULL);
+    return NULL;
+}
+
+static void *bench_spsc_batch_cons(void *arg){
+    Line *lines[DRAIN_MAX];
+    long n = 0;
+    for(;;){
+        size_t k = spsc_removeJobBatch(arg, lines, DRAIN_MAX);
+        if(lines[k - 1] == NULL) return (void *)(n + (long)k - 1);
+        n += (long)k;
+    }
+}
+
+/* Pushes BENCH_LINES pointers through each backend with no stdio or
+ * allocation in the loop, so only the hand-off itself is measured. */
+static double bench_pipe(void *q, void *(*prod_fn)(void *), void *(*cons_fn)(void *)){
+    pthread_t prod, cons;
+    void *got;
+
+    double t0 = bench_now_s();
+    pthread_create(&prod, NULL, prod_fn, q);
+    pthread_create(&cons, NULL, cons_fn, q);
+    pthread_join(prod, NULL);
+    pthread_join(cons, &got);
+    double dt = bench_now_s() - t0;
+
+    if((long)got != BENCH_LINES){
+        fprintf(stderr, "lost lines: %ld of %d\n", (long)got, BENCH_LINES);
+        exit(1);
+    }
+    return BENCH_LINES / dt;
+}
+
+static void bench_open_fail(const char *path){
+    perror(path);
+    exit(1);
+}
+
+/* Each reader hands every line to a stand-in consumer that only releases
+ * it, so the cost is reading, splitting and the per-line allocation. */
+static void bench_ingest_fgets(const char *path, int pooled, long *lines, long *bytes){
+    FILE *f = fopen(path, "r");
+    char buf[256];
+    if(!f) bench_open_fail(path);
+
+    while(fgets(buf, sizeof(buf), f)){
+        char *copy = pooled ? pool_strdup(buf) : strdup(buf);
+        if(!copy){
+            perror("strdup");
+            exit(1);
+        }
+        *bytes += (long)strlen(copy);
+        (*lines)++;
+        if(pooled) pool_free(copy);
+        else       free(copy);
+    }
+    fclose(f);
+}
+
+static void bench_ingest_reader(const char *path, int map, long *lines, long *bytes){
+    int fd = open(path, O_RDONLY);
+    LineReader in;
+    Line l;
+    if(fd < 0) bench_open_fail(path);
+
+    if(map) lr_init(&in, fd);
+    else    lr_init_stream(&in, fd);
+    while(lr_next(&in, &l)){
+        Line *line = pool_alloc(sizeof *line);
+        *line = l;
+        *bytes += (long)line->len;
+        (*lines)++;
+        line_release(line);
+        pool_free(line);
+    }
+    lr_close(&in);
+    close(fd);
+}
+
+static void bench_ingest(const char *path){
+    static const char *names[] = {
+        "fgets+strdup:     ", "fgets+pool_strdup:", "chunked read():   ", "mmap:             ",
+    };
+    long warm_lines = 0, warm_bytes = 0;
+    double base = 0;
+
+    /* first pass pulls the file into the page cache */
+    bench_ingest_reader(path, 0, &warm_lines, &warm_bytes);
+
+    for(int k = 0; k < 4; k++){
+        long lines = 0, bytes = 0;
+        double t0 = bench_now_s();
+        if(k < 2) bench_ingest_fgets(path, k, &lines, &bytes);
+        else      bench_ingest_reader(path, k == 3, &lines, &bytes);
+        double dt = bench_now_s() - t0;
+
+        if(k == 0) base = dt;
+        printf("%s %7.2f GB/s %12.0f lines/s (%.1fx)  %ld lines\n",
+               names[k], bytes / dt / 1e9, lines / dt, base / dt, lines);
+    }
+    printf("(fgets splits lines longer than 255 bytes; the readers do not)\n");
+}
+
+int main(int argc, char **argv){
+    (void)producer;
+    (void)consumer;
+
+    if(argc > 1){
+        bench_ingest(argv[1]);
+        return 0;
+    }
+
+    BoundedBuffer q;
+    q_init(&q, 1024);
+    double mutex_rate = bench_pipe(&q, bench_mutex_prod, bench_mutex_cons);
+    q_destroy(&q);
+
+    q_init(&q, 1024);
+    double mutex_batch_rate = bench_pipe(&q, bench_mutex_batch_prod, bench_mutex_batch_cons);
+    q_destroy(&q);
+
+    SpscRing r;
+    spsc_init(&r, 1024);
+    double spsc_rate = bench_pipe(&r, bench_spsc_prod, bench_spsc_cons);
+    spsc_destroy(&r);
+
+    spsc_init(&r, 1024);
+    double spsc_batch_rate = bench_pipe(&r, bench_spsc_batch_prod, bench_spsc_batch_cons);
+    spsc_destroy(&r);
+
+    printf("mutex+condvar: %12.0f lines/s\n", mutex_rate);
+    printf("mutex batched: %12.0f lines/s (%.1fx)\n", mutex_batch_rate, mutex_batch_rate / mutex_rate);
+    printf("spsc ring:     %12.0f lines/s (%.1fx)\n", spsc_rate, spsc_rate / mutex_rate);
+    printf("spsc batched:  %12.0f lines/s (%.1fx)\n", spsc_batch_rate, spsc_batch_rate / mutex_rate);
+    return 0;
+}
+
+#elif defined(BENCH_SUITE)
+/* Both pipes in bench/bench.c's suite; the queued element is the job's
+ * Line, as with real input. */
+#include "bench/bench.h"
+
+static void *suite_mutex_create(int arg, size_t cap){
+    BoundedBuffer *q = malloc(sizeof *q);
+    (void)arg;
+    if(!q){
+        perror("malloc");
+        exit(1);
+    }
+    q_init(q, cap);
+    return q;
+}
+
+static void suite_mutex_put(void *q, BenchJob *job){
+    Line *line = (Line *)job->item;
+    *line = job->line;
+    insertJob(q, line);
+}
+
+static BenchJob *suite_mutex_get(void *q, int self){
+    Line *line = removeJob(q);
+    (void)self;
+    return line ? bench_job_of(line) : NULL;
+}
+
+static void suite_mutex_stop(void *q, int ncons){
+    (void)ncons;
+    insertJob(q, NULL);
+}
+
+static void suite_mutex_destroy(void *q){
+    q_destroy(q);
+    free(q);
+}
+
+static void *suite_spsc_create(int arg, size_t cap){
+    SpscRing *r = malloc(sizeof *r);
+    (void)arg;
+    if(!r){
+        perror("malloc");
+        exit(1);
+    }
+    spsc_init(r, cap);
+    return r;
+}
+
+static void suite_spsc_put(void *q, BenchJob *job){
+    Line *line = (Line *)job->item;
+    *line = job->line;
+    spsc_insertJob(q, line);
+}
+
+static BenchJob *suite_spsc_get(void *q, int self){
+    Line *line = spsc_removeJob(q);
+    (void)self;
+    return line ? bench_job_of(line) : NULL;
+}
+
+static void suite_spsc_stop(void *q, int ncons){
+    (void)ncons;
+    spsc_insertJob(q, NULL);
+}
+
+static void suite_spsc_destroy(void *q){
+    spsc_destroy(q);
+    free(q);
+}
+
+void bench_register_single_prod_cons(void){
+    static const BenchCase cases[] = {
+        { "single_prod_cons", "mutex", "-", 0, 1, 1, 1, sizeof(Line),
+          suite_mutex_create, suite_mutex_put, suite_mutex_get, suite_mutex_stop, suite_mutex_destroy },
+        { "single_prod_cons", "spsc", "-", 0, 1, 1, 1, sizeof(Line),
+          suite_spsc_create, suite_spsc_put, suite_spsc_get, suite_spsc_stop, suite_spsc_destroy },
+    };
+    for(size_t i = 0; i < sizeof cases / sizeof cases[0]; i++) bench_add(&cases[i]);
+}
+
+#else
+
 int main(void){
 
-        BoundedBuffer q;
-        q_init(&q, 1024);
+        Pipe q;
+        pipe_init(&q, 1024);
         pthread_t prod, cons;
 
         pthread_create(&prod, NULL, producer, &q);
@@ -114,7 +655,9 @@ int main(void){
         pthread_join(prod, NULL);
         pthread_join(cons, NULL);
 
-        q_destroy(&q);
+        pipe_destroy(&q);
 
         return 0;
-}
\ No newline at end of file
+}
+
+#endif
@@ -0,0 +1,213 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+
+/* Hierarchical timing wheel, after the classic Linux timer wheel.
+ *
+ * WHEEL_LEVELS wheels of WHEEL_SLOTS lists each, one tick (WHEEL_TICK_US)
+ * per level-0 slot and WHEEL_SLOTS times coarser per level up. A timer goes
+ * on the finest level its distance fits in, so adding one is an index
+ * computation and a list push, and cancelling one is an unlink. Each time
+ * level 0 wraps, the next slot up is emptied and its timers re-added
+ * (cascaded) one level down, so every timer is touched at most
+ * WHEEL_LEVELS times however far out it is. A timer further out than the
+ * wheels reach is parked in the last slot that does and re-cascaded.
+ *
+ * One ticker thread advances the wheel in real time and runs the expired
+ * timers' callbacks outside the lock; a callback may re-arm its own
+ * timer. As with the kernel's del_timer(), a cancel that comes after the
+ * timer expired but before its callback ran does not stop the callback
+ * (timer_cancel() then returns 0). The ticker also publishes the tick
+ * count, so other threads can read the time with one load (wheel_now())
+ * instead of a clock_gettime. */
+
+#define WHEEL_BITS   6
+#define WHEEL_SLOTS  (1 << WHEEL_BITS)
+#define WHEEL_MASK   (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS 4                  /* 2^24 ticks, ~4.6 h at 1 ms */
+
+#ifndef WHEEL_TICK_US
+#define WHEEL_TICK_US 1000
+#endif
+
+typedef struct Timer Timer;
+typedef void (*timer_fn)(Timer *t);
+
+struct Timer {
+    Timer *next, *prev;                 /* in a slot while pending */
+    Timer *fire_next;                   /* ticker only */
+    uint64_t expires;                   /* in ticks */
+    timer_fn fn;
+    void *arg;
+    int pending;
+};
+
+typedef struct Wheel {
+    Timer slots[WHEEL_LEVELS][WHEEL_SLOTS];     /* list heads */
+    uint64_t tick;                      /* next tick to run */
+    _Atomic uint64_t now;               /* last tick run, for readers */
+    int stop;
+    pthread_mutex_t mtx;
+    pthread_t ticker;
+} Wheel;
+
+static inline void timer_init(Timer *t, timer_fn fn, void *arg) {
+    t->next = t->prev = t->fire_next = NULL;
+    t->fn = fn;
+    t->arg = arg;
+    t->pending = 0;
+}
+
+/* caller holds w->mtx */
+static inline void wheel_link(Wheel *w, Timer *t) {
+    uint64_t delta = t->expires > w->tick ? t->expires - w->tick : 0;
+    int lvl = 0;
+    while (lvl < WHEEL_LEVELS - 1 && delta >> (WHEEL_BITS * (lvl + 1))) lvl++;
+
+    uint64_t at = t->expires > w->tick ? t->expires : w->tick;
+    if (delta >> (WHEEL_BITS * WHEEL_LEVELS)) {
+        /* out of reach: park in the furthest slot, re-cascade from there */
+        at = w->tick + ((uint64_t)1 << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+    }
+    Timer *head = &w->slots[lvl][(at >> (WHEEL_BITS * lvl)) & WHEEL_MASK];
+    t->prev = head;
+    t->next = head->next;
+    head->next->prev = t;
+    head->next = t;
+    t->pending = 1;
+}
+
+/* caller holds w->mtx */
+static inline void wheel_unlink(Timer *t) {
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+    t->next = t->prev = NULL;
+    t->pending = 0;
+}
+
+/* Arms t to fire on the ticks-th tick boundary from now, i.e. after
+ * ticks - 1 to ticks ticks (0 means the next tick); re-arms it if it is
+ * already pending. */
+static inline void timer_add(Wheel *w, Timer *t, uint64_t ticks) {
+    pthread_mutex_lock(&w->mtx);
+    if (t->pending) wheel_unlink(t);
+    t->expires = w->tick + (ticks ? ticks - 1 : 0);
+    wheel_link(w, t);
+    pthread_mutex_unlock(&w->mtx);
+}
+
+/* Returns 1 if t was pending and will now not fire. */
+static inline int timer_cancel(Wheel *w, Timer *t) {
+    int was;
+    pthread_mutex_lock(&w->mtx);
+    was = t->pending;
+    if (was) wheel_unlink(t);
+    pthread_mutex_unlock(&w->mtx);
+    return was;
+}
+
+static inline uint64_t wheel_now(Wheel *w) {
+    return atomic_load_explicit(&w->now, memory_order_relaxed);
+}
+
+/* caller holds w->mtx; moves slot idx of level lvl down a level */
+static inline void wheel_cascade(Wheel *w, int lvl, size_t idx) {
+    Timer *head = &w->slots[lvl][idx];
+    Timer *t = head->next;
+    head->next = head->prev = head;
+    while (t != head) {
+        Timer *next = t->next;
+        wheel_link(w, t);
+        t = next;
+    }
+}
+
+/* Runs one tick: cascades if level 0 wrapped, then fires its slot. */
+static inline void wheel_tick(Wheel *w) {
+    Timer *fired = NULL;
+
+    pthread_mutex_lock(&w->mtx);
+    size_t idx = w->tick & WHEEL_MASK;
+    for (int lvl = 1; idx == 0 && lvl < WHEEL_LEVELS; lvl++) {
+        idx = (w->tick >> (WHEEL_BITS * lvl)) & WHEEL_MASK;
+        wheel_cascade(w, lvl, idx);
+    }
+
+    /* once unlocked an expired timer may be re-armed by anyone, so the
+     * batch is chained through fire_next, which only the ticker uses */
+    Timer *head = &w->slots[0][w->tick & WHEEL_MASK];
+    while (head->next != head) {
+        Timer *t = head->next;
+        wheel_unlink(t);
+        t->fire_next = fired;
+        fired = t;
+    }
+    atomic_store_explicit(&w->now, w->tick, memory_order_relaxed);
+    w->tick++;
+    pthread_mutex_unlock(&w->mtx);
+
+    while (fired) {
+        Timer *t = fired;
+        fired = t->fire_next;
+        t->fn(t);
+    }
+}
+
+static inline void *wheel_ticker(void *arg) {
+    Wheel *w = arg;
+    struct timespec start, next;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    next = start;
+
+    for (;;) {
+        next.tv_nsec += WHEEL_TICK_US * 1000L;
+        next.tv_sec  += next.tv_nsec / 1000000000L;
+        next.tv_nsec %= 1000000000L;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+        pthread_mutex_lock(&w->mtx);
+        int stop = w->stop;
+        pthread_mutex_unlock(&w->mtx);
+        if (stop) return NULL;
+
+        /* catch up on ticks missed while descheduled */
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        uint64_t due = (uint64_t)((now.tv_sec - start.tv_sec) * 1000000L +
+                                  (now.tv_nsec - start.tv_nsec) / 1000) / WHEEL_TICK_US;
+        while (w->tick <= due) wheel_tick(w);
+    }
+}
+
+static inline void wheel_init(Wheel *w) {
+    for (int lvl = 0; lvl < WHEEL_LEVELS; lvl++) {
+        for (int i = 0; i < WHEEL_SLOTS; i++) {
+            w->slots[lvl][i].next = w->slots[lvl][i].prev = &w->slots[lvl][i];
+        }
+    }
+    w->tick = 0;
+    atomic_init(&w->now, 0);
+    w->stop = 0;
+    pthread_mutex_init(&w->mtx, NULL);
+    if (pthread_create(&w->ticker, NULL, wheel_ticker, w) != 0) {
+        perror("pthread_create ticker");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Stops the ticker; timers still pending never fire. */
+static inline void wheel_destroy(Wheel *w) {
+    pthread_mutex_lock(&w->mtx);
+    w->stop = 1;
+    pthread_mutex_unlock(&w->mtx);
+    pthread_join(w->ticker, NULL);
+    pthread_mutex_destroy(&w->mtx);
+}
+
+#endif
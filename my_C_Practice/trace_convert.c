@@ -0,0 +1,179 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "line_reader.h"
+#include "out_writer.h"
+#include "job_trace.h"
+
+/* Converts between CSV and the binary job traces of job_trace.h.
+ *
+ *   trace_convert in.csv out.trace   CSV to trace ("-" reads stdin)
+ *   trace_convert -d in.trace        trace back to CSV, on stdout
+ *
+ * A CSV line is arrival_us,cost,priority,deadline_us,payload: the payload
+ * is the rest of the line, commas and all, and is stored with a newline so
+ * it replays as the same Line stdin would have given. Lines that do not start with a
+ * digit (a header, comments, blank lines) are skipped. Records are sorted
+ * by arrival, input order among equals, so a log merged from several
+ * machines can go in as is.
+ *
+ * gcc -O2 -pthread trace_convert.c -o trace_convert */
+
+typedef struct RecVec {
+    TraceRec *v;
+    size_t count, cap;
+} RecVec;
+
+static void rec_push(RecVec *rv, const TraceRec *r) {
+    if (rv->count == rv->cap) {
+        rv->cap = rv->cap ? 2 * rv->cap : 4096;
+        rv->v = realloc(rv->v, rv->cap * sizeof *rv->v);
+        if (!rv->v) {
+            perror("realloc records");
+            exit(EXIT_FAILURE);
+        }
+    }
+    rv->v[rv->count++] = *r;
+}
+
+/* Reads digits at *p and the comma after them. Returns 0 if there are
+ * none, they overflow 64 bits or no comma follows. */
+static int parse_field(const char **p, const char *end, uint64_t *out) {
+    const char *s = *p;
+    uint64_t v = 0;
+    if (s == end || *s < '0' || *s > '9') return 0;
+    while (s < end && *s >= '0' && *s <= '9') {
+        uint64_t digit = (uint64_t)(*s++ - '0');
+        if (v > (UINT64_MAX - digit) / 10) return 0;
+        v = v * 10 + digit;
+    }
+    if (s == end || *s != ',') return 0;
+    *out = v;
+    *p = s + 1;
+    return 1;
+}
+
+/* payload_off is the input order, so it breaks ties */
+static int rec_cmp(const void *a, const void *b) {
+    const TraceRec *x = a, *y = b;
+    if (x->arrival_us != y->arrival_us) return x->arrival_us < y->arrival_us ? -1 : 1;
+    return (x->payload_off > y->payload_off) - (x->payload_off < y->payload_off);
+}
+
+static void write_all(FILE *f, const void *buf, size_t len, const char *what) {
+    if (len && fwrite(buf, 1, len, f) != len) {
+        perror(what);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static int to_trace(const char *in_path, const char *out_path) {
+    int fd = strcmp(in_path, "-") == 0 ? STDIN_FILENO : open(in_path, O_RDONLY);
+    if (fd < 0) {
+        perror(in_path);
+        return EXIT_FAILURE;
+    }
+
+    /* payloads go to a scratch file until the records are sorted */
+    FILE *blob = tmpfile();
+    if (!blob) {
+        perror("tmpfile");
+        return EXIT_FAILURE;
+    }
+
+    LineReader in;
+    Line line;
+    RecVec rv = { NULL, 0, 0 };
+    uint64_t blob_len = 0;
+    long skipped = 0, bad = 0;
+
+    lr_init(&in, fd);
+    while (lr_next(&in, &line)) {
+        const char *p = line.ptr, *end = line.ptr + line.len;
+        while (end > p && (end[-1] == '\n' || end[-1] == '\r')) end--;
+
+        if (p == end || *p < '0' || *p > '9') {
+            skipped++;
+            line_release(&line);
+            continue;
+        }
+
+        uint64_t arrival, cost, prio, deadline;
+        if (!parse_field(&p, end, &arrival) || !parse_field(&p, end, &cost) ||
+            !parse_field(&p, end, &prio) || !parse_field(&p, end, &deadline) ||
+            cost > UINT32_MAX || prio > UINT32_MAX || (uint64_t)(end - p) >= UINT32_MAX) {
+            fprintf(stderr, "line %ld: malformed, skipped\n", line.no + 1);
+            bad++;
+            line_release(&line);
+            continue;
+        }
+
+        TraceRec r = { arrival, deadline, blob_len, (uint32_t)(end - p) + 1,
+                       (uint32_t)cost, (uint32_t)prio, 0 };
+        write_all(blob, p, (size_t)(end - p), "write payload");
+        write_all(blob, "\n", 1, "write payload");
+        blob_len += r.payload_len;
+        rec_push(&rv, &r);
+        line_release(&line);
+    }
+    lr_close(&in);
+    if (fd != STDIN_FILENO) close(fd);
+
+    qsort(rv.v, rv.count, sizeof *rv.v, rec_cmp);
+
+    FILE *out = fopen(out_path, "wb");
+    if (!out) {
+        perror(out_path);
+        return EXIT_FAILURE;
+    }
+    TraceHeader h = { TRACE_MAGIC, TRACE_VERSION, rv.count,
+                      sizeof h + rv.count * sizeof(TraceRec) };
+    write_all(out, &h, sizeof h, out_path);
+    write_all(out, rv.v, rv.count * sizeof *rv.v, out_path);
+
+    char buf[1 << 16];
+    size_t n;
+    rewind(blob);
+    while ((n = fread(buf, 1, sizeof buf, blob)) > 0) write_all(out, buf, n, out_path);
+    if (ferror(blob) || fclose(out) != 0) {
+        perror(out_path);
+        return EXIT_FAILURE;
+    }
+    fclose(blob);
+
+    fprintf(stderr, "%zu records, %llu payload bytes (%ld skipped, %ld malformed)\n",
+            rv.count, (unsigned long long)blob_len, skipped, bad);
+    free(rv.v);
+    return EXIT_SUCCESS;
+}
+
+static int to_csv(const char *path) {
+    static Writer out;
+    Trace t;
+    const TraceRec *r;
+
+    trace_open(&t, path);
+    out_init(&out, STDOUT_FILENO);
+    while ((r = trace_next(&t))) {
+        Line l = trace_payload(&t, r);
+        out_printf(&out, "%llu,%u,%u,%llu,", (unsigned long long)r->arrival_us,
+                   r->cost, r->priority, (unsigned long long)r->deadline_us);
+        out_line(&out, &l);
+    }
+    out_close(&out);
+    trace_close(&t);
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv) {
+    if (argc == 3 && strcmp(argv[1], "-d") == 0) return to_csv(argv[2]);
+    if (argc == 3) return to_trace(argv[1], argv[2]);
+
+    fprintf(stderr, "usage: %s in.csv out.trace\n"
+                    "       %s -d in.trace\n", argv[0], argv[0]);
+    return EXIT_FAILURE;
+}
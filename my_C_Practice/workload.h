@@ -0,0 +1,303 @@
+#ifndef WORKLOAD_H
+#define WORKLOAD_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <limits.h>
+
+#include "line_reader.h"
+#include "job_trace.h"
+
+/* Synthetic workloads for the producer/consumer programs.
+ *
+ * Each thread draws from its own xoshiro256** generator, seeded through
+ * splitmix64 from wl_seed() and a per-thread serial, so producers neither
+ * share state (as rand() does, behind a lock) nor repeat each other. A
+ * draw is a handful of shifts and multiplies.
+ *
+ * Job ids for generated jobs come from a shared counter WL_ID_BLOCK at a
+ * time, so the counter's cache line moves once per block rather than once
+ * per job. Each producer uses up every id of a block it claimed before it
+ * claims another, and the last block is cut at the job count, so the ids
+ * handed out are exactly 0 .. count-1, which ORDERED_OUTPUT relies on.
+ *
+ * Costs and priorities are drawn by wl_draw() from one of four shapes
+ * over a program's [lo, hi]: uniform, exponential and Pareto (both with
+ * mean (lo + hi) / 2, starting at lo, and unbounded above) and bimodal
+ * (WL_BIMODAL_P of draws in the bottom tenth of the range, the rest in the
+ * top tenth). Arrivals are back to back, Poisson at WL_RATE jobs/s, or
+ * bursty: runs of WL_BURST jobs at WL_BURST_X times the rate, separated by
+ * idle gaps that keep the mean rate at WL_RATE.
+ *
+ * A JobSource puts this together with the other inputs: producers call
+ * src_next() for each job, which generates it when GEN_JOBS is set, else
+ * takes the next trace record (job_trace.h), else the next line of stdin
+ * with a cost and priority drawn as above.
+ *
+ * The draws use log() and pow(): link with -lm. */
+
+enum wl_dist { WL_UNIFORM, WL_EXP, WL_PARETO, WL_BIMODAL };
+enum wl_arrival { WL_ASAP, WL_POISSON, WL_BURSTY };
+
+/* 0 = jobs come from stdin (or a trace); N = generate N jobs */
+#ifndef GEN_JOBS
+#define GEN_JOBS 0
+#endif
+
+#ifndef GEN_COST
+#define GEN_COST WL_UNIFORM
+#endif
+
+#ifndef GEN_PRIO
+#define GEN_PRIO WL_UNIFORM
+#endif
+
+#ifndef GEN_ARRIVAL
+#define GEN_ARRIVAL WL_ASAP
+#endif
+
+#ifndef WL_RATE
+#define WL_RATE 100000          /* jobs/s over all producers */
+#endif
+
+#define WL_BURST     64
+#define WL_BURST_X   16
+#define WL_BIMODAL_P 0.9
+#define WL_ID_BLOCK  1024
+
+typedef struct WlRng {
+    uint64_t s[4];
+    int seeded;
+} WlRng;
+
+static _Atomic uint64_t wl_seed_base = 0x9e3779b97f4a7c15ULL;
+static _Atomic uint64_t wl_serial;
+static __thread WlRng wl_rng;
+
+static inline uint64_t wl_splitmix(uint64_t *x) {
+    uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+/* Seeds every thread's generator from now on; call before starting them. */
+static inline void wl_seed(uint64_t seed) {
+    atomic_store(&wl_seed_base, seed);
+}
+
+static inline uint64_t wl_rotl(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+static inline uint64_t wl_next(void) {
+    WlRng *r = &wl_rng;
+    if (!r->seeded) {
+        uint64_t x = atomic_load(&wl_seed_base) ^
+                     (atomic_fetch_add(&wl_serial, 1) * 0xd1b54a32d192ed03ULL);
+        for (int i = 0; i < 4; i++) r->s[i] = wl_splitmix(&x);
+        r->seeded = 1;
+    }
+
+    uint64_t *s = r->s;
+    uint64_t out = wl_rotl(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = wl_rotl(s[3], 45);
+    return out;
+}
+
+/* uniform in [0, 1) */
+static inline double wl_unit(void) {
+    return (double)(wl_next() >> 11) * 0x1.0p-53;
+}
+
+/* uniform integer in [lo, hi], like lo + rand() % (hi - lo + 1) */
+static inline int wl_range(int lo, int hi) {
+    uint64_t span = (uint64_t)((int64_t)hi - lo + 1);
+    return lo + (int)(((wl_next() >> 32) * span) >> 32);
+}
+
+/* A value from dist over [lo, hi]; see the top of the file. */
+static inline double wl_draw(int dist, double lo, double hi) {
+    double mean = (lo + hi) / 2;
+    double u = 1.0 - wl_unit();                 /* (0, 1] */
+
+    switch (dist) {
+    case WL_EXP:
+        return lo - (mean - lo) * log(u);
+    case WL_PARETO: {
+        double alpha = mean / (mean - lo);      /* mean of x_m = lo */
+        return lo / pow(u, 1.0 / alpha);
+    }
+    case WL_BIMODAL: {
+        double band = (hi - lo) / 10;
+        if (wl_unit() < WL_BIMODAL_P) return lo + band * wl_unit();
+        return hi - band * wl_unit();
+    }
+    default:
+        return lo + (hi - lo) * wl_unit();
+    }
+}
+
+/* wl_draw() rounded to an int in [lo, max] */
+static inline int wl_draw_int(int dist, int lo, int hi, int max) {
+    double v = wl_draw(dist, lo, hi + 1.0);
+    if (v >= (double)max) return max;
+    return v < lo ? lo : (int)v;
+}
+
+typedef struct WlIds {
+    _Atomic long next;
+    long limit;
+} WlIds;
+
+static __thread long wl_id_cur, wl_id_end;
+
+static inline void wl_ids_init(WlIds *ids, long limit) {
+    atomic_init(&ids->next, 0);
+    ids->limit = limit;
+}
+
+/* Next id for this thread. Returns 0 once all limit ids are handed out. */
+static inline int wl_claim(WlIds *ids, long *id) {
+    if (wl_id_cur == wl_id_end) {
+        long start = atomic_fetch_add_explicit(&ids->next, WL_ID_BLOCK, memory_order_relaxed);
+        if (start >= ids->limit) return 0;
+        wl_id_cur = start;
+        wl_id_end = start + WL_ID_BLOCK < ids->limit ? start + WL_ID_BLOCK : ids->limit;
+    }
+    *id = wl_id_cur++;
+    return 1;
+}
+
+/* Microseconds from the previous arrival to the next under GEN_ARRIVAL,
+ * for a stream carrying rate jobs/s. */
+static inline double wl_gap_us(double rate) {
+    static __thread long burst_left;
+    double mean = 1e6 / rate;
+
+    switch (GEN_ARRIVAL) {
+    case WL_POISSON:
+        return -mean * log(1.0 - wl_unit());
+    case WL_BURSTY:
+        if (burst_left-- > 0) return -(mean / WL_BURST_X) * log(1.0 - wl_unit());
+        burst_left = WL_BURST - 1;
+        /* the idle gap makes up what the burst ran ahead */
+        return mean * WL_BURST * (1.0 - 1.0 / WL_BURST_X) * -log(1.0 - wl_unit());
+    default:
+        return 0;
+    }
+}
+
+/* Holds a producer to its arrival times: it sleeps only once it is more
+ * than a millisecond ahead, so a fast stream costs no system calls. */
+typedef struct WlPacer {
+    struct timespec start;
+    double due_us;                      /* next arrival, since start */
+    double slept_to_us;
+} WlPacer;
+
+static inline void wl_pacer_init(WlPacer *p) {
+    clock_gettime(CLOCK_MONOTONIC, &p->start);
+    p->due_us = p->slept_to_us = 0;
+}
+
+static inline void wl_pace(WlPacer *p, double gap_us) {
+    p->due_us += gap_us;
+    if (p->due_us - p->slept_to_us < 1000) return;
+
+    struct timespec due = p->start;
+    long long ns = (long long)(p->due_us * 1000);
+    due.tv_sec  += (time_t)(ns / 1000000000LL);
+    due.tv_nsec += (long)(ns % 1000000000LL);
+    if (due.tv_nsec >= 1000000000L) {
+        due.tv_sec++;
+        due.tv_nsec -= 1000000000L;
+    }
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL) == EINTR) {
+    }
+    p->slept_to_us = p->due_us;
+}
+
+/* Where producers get their jobs from; shared by all of them. */
+typedef struct JobSource {
+    LineReader *in;                     /* stdin */
+    Trace *trace;                       /* or NULL */
+    WlIds gen;                          /* GEN_JOBS */
+    long first_no;                      /* input jobs: id = line number - this */
+    int cost_lo, cost_hi;               /* the program's ranges */
+    int prio_lo, prio_hi;
+    int producers;                      /* WL_RATE is split between them */
+} JobSource;
+
+typedef struct JobDraw {
+    long id;
+    Line payload;
+    int cost;
+    int priority;
+    long arrival;                       /* virtual units, -1 = none */
+    uint64_t deadline_us;               /* relative, 0 = none */
+} JobDraw;
+
+static const char wl_payload[] = "synthetic job\n";
+
+/* Call once stdin's header lines (the policy) have been read: jobs from
+ * input are numbered by line, so ids follow input order even with several
+ * producers. */
+static inline void src_init(JobSource *s, LineReader *in, Trace *trace, int producers,
+                            int cost_lo, int cost_hi, int prio_lo, int prio_hi) {
+    s->in = in;
+    s->trace = trace;
+    wl_ids_init(&s->gen, GEN_JOBS);
+    s->first_no = trace ? 0 : in->lines;
+    s->cost_lo = cost_lo;
+    s->cost_hi = cost_hi;
+    s->prio_lo = prio_lo;
+    s->prio_hi = prio_hi;
+    s->producers = producers;
+}
+
+/* Fills in the next job; returns 0 once the source is exhausted. With a
+ * pacer (threaded producers) it waits for the job's arrival; without one
+ * (SIMULATE) it reports the arrival in units of TRACE_UNIT_US instead. */
+static inline int src_next(JobSource *s, WlPacer *pacer, JobDraw *d) {
+    static __thread double virtual_us;
+    const TraceRec *rec = NULL;
+
+    if (GEN_JOBS) {
+        if (!wl_claim(&s->gen, &d->id)) return 0;
+        d->payload = (Line){ wl_payload, sizeof wl_payload - 1, NULL, d->id };
+        double gap = wl_gap_us((double)WL_RATE / (pacer ? s->producers : 1));
+        if (pacer) wl_pace(pacer, gap);
+        virtual_us += gap;
+        d->arrival = GEN_ARRIVAL == WL_ASAP ? -1 : (long)(virtual_us / TRACE_UNIT_US);
+    } else {
+        if (!trace_input(s->trace, s->in, &d->payload, &rec)) return 0;
+        if (rec && pacer) trace_pace(s->trace, rec);
+        d->id = d->payload.no - s->first_no;
+        d->arrival = trace_arrival(rec);
+    }
+
+    if (rec) {
+        d->cost = trace_clamp(rec->cost, 1, INT_MAX - 1);
+        d->priority = trace_clamp(rec->priority, s->prio_lo, s->prio_hi);
+        d->deadline_us = rec->deadline_us;
+    } else {
+        d->cost = wl_draw_int(GEN_COST, s->cost_lo, s->cost_hi, INT_MAX - 1);
+        d->priority = wl_draw_int(GEN_PRIO, s->prio_lo, s->prio_hi, s->prio_hi);
+        d->deadline_us = 0;
+    }
+    return 1;
+}
+
+#endif